@@ -0,0 +1,377 @@
+#include "global.h"
+#include <string.h>
+#include <time.h>
+
+// Sweep benchmark: every backend over input length x tap count (x work-group size for
+// OpenCL), each point warmed up and then repeated, results as CSV or JSON.
+//   fir-bench [--format csv|json] [--out file|-] [--min-length N] [--max-length N]
+//             [--taps 16,64,...] [--backends scalar,simd,threaded,opencl,opencl-tiled]
+//             [--reps N] [--warmup N]
+
+char* kernelSource;
+cl_platform_id* platform;
+cl_device_id* device;
+cl_context context;
+cl_command_queue queue;
+cl_kernel kernel;
+cl_program program;
+
+#define BENCH_MIN_LENGTH 512
+#define BENCH_MAX_LENGTH (1 << 26)
+#define BENCH_REPS 10
+#define BENCH_WARMUP 2
+// The scalar loop is only timed up to this many multiply-adds per run
+#define BENCH_SCALAR_MAX_MACS (1ULL << 30)
+#define BENCH_MAX_TAPS_LIST 16
+
+static const size_t defaultTaps[] = {8, 16, 64, 256, 1024};
+static const size_t workGroupSizes[] = {32, 64, 128, 256};
+
+typedef enum {
+    BENCH_SCALAR = 0,
+    BENCH_SIMD,
+    BENCH_THREADED,
+    BENCH_OPENCL,
+    BENCH_OPENCL_TILED,
+    BENCH_BACKENDS
+} BenchBackend;
+
+static const char* backendNames[BENCH_BACKENDS] = {"scalar", "simd", "threaded", "opencl", "opencl-tiled"};
+
+typedef struct {
+    double median;
+    double p99;
+} BenchStat;
+
+typedef struct {
+    FILE* out;
+    bool json;
+    bool first;
+    unsigned reps;
+    unsigned warmup;
+} BenchReport;
+
+static int compareDouble(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank median and 99th percentile; sorts samples
+static BenchStat benchStat(double* samples, unsigned count) {
+    BenchStat stat = {0.0, 0.0};
+    if(count == 0)
+        return stat;
+    qsort(samples, count, sizeof(double), compareDouble);
+    stat.median = samples[(count - 1) / 2];
+    unsigned rank = (unsigned)(0.99 * count + 0.999999);
+    stat.p99 = samples[(rank ? rank : 1) - 1];
+    return stat;
+}
+
+static double nowUs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static double eventUs(cl_event event) {
+    cl_ulong start = 0, end = 0;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+    return (end - start) / 1000.0;
+}
+
+static void reportHeader(BenchReport* report) {
+    char name[256] = "";
+    clGetDeviceInfo(device[0], CL_DEVICE_NAME, sizeof(name), name, NULL);
+    if(report->json){
+        fprintf(report->out, "{\n  \"device\": \"%s\",\n  \"cpu_isa\": \"%s\",\n  \"cpu_threads\": %u,\n"
+                "  \"reps\": %u,\n  \"warmup\": %u,\n  \"results\": [",
+                name, firSimdIsaName(firSimdIsa()), firPoolCores(), report->reps, report->warmup);
+    }
+    else{
+        fprintf(report->out, "backend,length,taps,work_group,kernel_median_us,kernel_p99_us,copy_median_us,copy_p99_us,"
+                "read_median_us,read_p99_us,msamples_per_s,gb_per_s,gflop_per_s\n");
+    }
+    report->first = true;
+}
+
+static void reportPoint(BenchReport* report, BenchBackend backend, size_t length, size_t tapsCount, size_t workGroup,
+                        BenchStat kernelTime, BenchStat copyTime, BenchStat readTime) {
+    const double outputs = (double)(length - tapsCount + 1);
+    const double seconds = kernelTime.median / 1e6;
+    // Effective traffic: every input read and every output written once
+    const double bytes = length * sizeof(short) + outputs * sizeof(float);
+    const double msps = seconds > 0 ? outputs / seconds / 1e6 : 0.0;
+    const double gbps = seconds > 0 ? bytes / seconds / 1e9 : 0.0;
+    const double gflops = seconds > 0 ? 2.0 * tapsCount * outputs / seconds / 1e9 : 0.0;
+    if(report->json){
+        fprintf(report->out, "%s\n    {\"backend\": \"%s\", \"length\": %zu, \"taps\": %zu, \"work_group\": %zu, "
+                "\"kernel_us\": {\"median\": %.3f, \"p99\": %.3f}, \"copy_us\": {\"median\": %.3f, \"p99\": %.3f}, "
+                "\"read_us\": {\"median\": %.3f, \"p99\": %.3f}, \"msamples_per_s\": %.3f, \"gb_per_s\": %.3f, "
+                "\"gflop_per_s\": %.3f}",
+                report->first ? "" : ",", backendNames[backend], length, tapsCount, workGroup,
+                kernelTime.median, kernelTime.p99, copyTime.median, copyTime.p99, readTime.median, readTime.p99,
+                msps, gbps, gflops);
+    }
+    else{
+        fprintf(report->out, "%s,%zu,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                backendNames[backend], length, tapsCount, workGroup,
+                kernelTime.median, kernelTime.p99, copyTime.median, copyTime.p99, readTime.median, readTime.p99,
+                msps, gbps, gflops);
+    }
+    report->first = false;
+    fflush(report->out);
+    fprintf(stderr, "%-13s length %9zu taps %5zu wg %4zu: %10.3f us median, %8.2f MSamples/s\n",
+            backendNames[backend], length, tapsCount, workGroup, kernelTime.median, msps);
+}
+
+static void reportFooter(BenchReport* report) {
+    if(report->json)
+        fprintf(report->out, "\n  ]\n}\n");
+}
+
+static void benchCpu(BenchReport* report, BenchBackend backend, FirPool* pool, const short* input, size_t length,
+                     const float* taps, size_t tapsCount, float* output) {
+    const FirIsa bestIsa = firSimdIsa();
+    if(backend == BENCH_SCALAR)
+        firSimdSetIsa(FIR_ISA_SCALAR);
+    const size_t outputCount = length - tapsCount + 1;
+    double* samples = (double*)malloc(sizeof(double) * report->reps);
+    double* zeros = (double*)calloc(report->reps, sizeof(double));
+    for(unsigned rep = 0; rep < report->warmup + report->reps; rep++){
+        double start = nowUs();
+        if(backend == BENCH_THREADED)
+            firPoolFilter(pool, input, outputCount, taps, tapsCount, output);
+        else
+            firSimd(input, outputCount, taps, tapsCount, output);
+        if(rep >= report->warmup)
+            samples[rep - report->warmup] = nowUs() - start;
+    }
+    firSimdSetIsa(bestIsa);
+    BenchStat none = benchStat(zeros, report->reps);
+    reportPoint(report, backend, length, tapsCount, backend == BENCH_THREADED ? firPoolThreads(pool) : 1,
+                benchStat(samples, report->reps), none, none);
+    free(samples);
+    free(zeros);
+}
+
+// One upload, launch and readback per rep, each timed by its own profiling event
+static void benchOpenCL(BenchReport* report, BenchBackend backend, const FirClEnv* env, const FirClFilter* filter,
+                        size_t workGroup, cl_mem inputMem, cl_mem outputMem, cl_mem tapsMem, const short* input,
+                        size_t length, size_t tapsCount, float* output) {
+    cl_int status;
+    const size_t outputCount = length - tapsCount + 1;
+    double* kernelSamples = (double*)malloc(sizeof(double) * report->reps);
+    double* copySamples = (double*)malloc(sizeof(double) * report->reps);
+    double* readSamples = (double*)malloc(sizeof(double) * report->reps);
+    cl_uint tapsArg = (cl_uint)tapsCount, outputsArg = (cl_uint)outputCount;
+    for(unsigned rep = 0; rep < report->warmup + report->reps; rep++){
+        cl_event copyEvent, kernelEvent, readEvent;
+        status = clEnqueueWriteBuffer(env->queue, inputMem, CL_FALSE, 0, length * sizeof(short), input, 0, NULL, &copyEvent);
+        error(status, "Failed to write the benchmark input");
+        if(backend == BENCH_OPENCL){
+            status  = clSetKernelArg(filter->kernel, 0, sizeof(cl_mem), &inputMem);
+            status |= clSetKernelArg(filter->kernel, 1, sizeof(cl_mem), &outputMem);
+            status |= clSetKernelArg(filter->kernel, 2, sizeof(cl_mem), &tapsMem);
+            status |= clSetKernelArg(filter->kernel, 3, sizeof(cl_uint), &tapsArg);
+            status |= clSetKernelArg(filter->kernel, 4, sizeof(cl_uint), &outputsArg);
+            error(status, "Failed to set the benchmark kernel arguments");
+            size_t local_work_size[1] = {workGroup};
+            size_t global_work_size[1] = {(outputCount + workGroup - 1) / workGroup * workGroup};
+            status = clEnqueueNDRangeKernel(env->queue, filter->kernel, 1, NULL, global_work_size, local_work_size, 0, NULL, &kernelEvent);
+        }
+        else{
+            status = firClEnqueueFilter(env, filter, inputMem, outputMem, tapsMem, tapsArg, outputsArg, &kernelEvent);
+        }
+        error(status, "Failed to launch the benchmark kernel");
+        status = clEnqueueReadBuffer(env->queue, outputMem, CL_TRUE, 0, outputCount * sizeof(float), output, 0, NULL, &readEvent);
+        error(status, "Failed to read the benchmark output");
+        if(rep >= report->warmup){
+            copySamples[rep - report->warmup] = eventUs(copyEvent);
+            kernelSamples[rep - report->warmup] = eventUs(kernelEvent);
+            readSamples[rep - report->warmup] = eventUs(readEvent);
+        }
+        clReleaseEvent(copyEvent);
+        clReleaseEvent(kernelEvent);
+        clReleaseEvent(readEvent);
+    }
+    reportPoint(report, backend, length, tapsCount, workGroup, benchStat(kernelSamples, report->reps),
+                benchStat(copySamples, report->reps), benchStat(readSamples, report->reps));
+    free(kernelSamples);
+    free(copySamples);
+    free(readSamples);
+}
+
+static size_t parseList(const char* text, size_t* values, size_t maxValues) {
+    size_t count = 0;
+    char* end = (char*)text;
+    while(count < maxValues){
+        values[count++] = strtoull(text, &end, 10);
+        if(*end != ',')
+            break;
+        text = end + 1;
+    }
+    return count;
+}
+
+// Lengths grow 4x per step; the last step lands exactly on maxLength, 0 ends the sweep
+static size_t nextLength(size_t length, size_t maxLength) {
+    if(length >= maxLength)
+        return 0;
+    return length * 4 < maxLength ? length * 4 : maxLength;
+}
+
+int main(int argc, char** argv)
+{
+    BenchReport report = {stdout, false, true, BENCH_REPS, BENCH_WARMUP};
+    const char* outPath = NULL;
+    size_t minLength = BENCH_MIN_LENGTH, maxLength = BENCH_MAX_LENGTH;
+    size_t tapsList[BENCH_MAX_TAPS_LIST];
+    size_t tapsListCount = sizeof(defaultTaps) / sizeof(defaultTaps[0]);
+    memcpy(tapsList, defaultTaps, sizeof(defaultTaps));
+    bool backends[BENCH_BACKENDS] = {true, true, true, true, true};
+
+    for(int i = 1; i < argc; i++){
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if(value == NULL){
+            fprintf(stderr, "Missing value for %s\n", argv[i]);
+            return 1;
+        }
+        if(strcmp(argv[i], "--format") == 0)
+            report.json = strcmp(value, "json") == 0;
+        else if(strcmp(argv[i], "--out") == 0)
+            outPath = value;
+        else if(strcmp(argv[i], "--min-length") == 0)
+            minLength = strtoull(value, NULL, 10);
+        else if(strcmp(argv[i], "--max-length") == 0)
+            maxLength = strtoull(value, NULL, 10);
+        else if(strcmp(argv[i], "--taps") == 0)
+            tapsListCount = parseList(value, tapsList, BENCH_MAX_TAPS_LIST);
+        else if(strcmp(argv[i], "--reps") == 0)
+            report.reps = (unsigned)strtoul(value, NULL, 10);
+        else if(strcmp(argv[i], "--warmup") == 0)
+            report.warmup = (unsigned)strtoul(value, NULL, 10);
+        else if(strcmp(argv[i], "--backends") == 0){
+            for(int b = 0; b < BENCH_BACKENDS; b++){
+                const char* found = strstr(value, backendNames[b]);
+                // "opencl" must not match inside "opencl-tiled"
+                while(found != NULL && found[strlen(backendNames[b])] != '\0' && found[strlen(backendNames[b])] != ',')
+                    found = strstr(found + 1, backendNames[b]);
+                backends[b] = found != NULL;
+            }
+        }
+        else{
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+        i++;
+    }
+    if(report.reps == 0)
+        report.reps = 1;
+
+    if(!init()) {
+        return -1;
+    }
+    // init() reports on stdout, so results go to a file unless asked for "-"
+    if(outPath == NULL)
+        outPath = report.json ? "fir-bench.json" : "fir-bench.csv";
+    if(strcmp(outPath, "-") != 0){
+        report.out = fopen(outPath, "w");
+        if(report.out == NULL){
+            fprintf(stderr, "Failed to open %s\n", outPath);
+            return 1;
+        }
+    }
+
+    FirClEnv env = { context, device[0], queue, program, kernelSource };
+    FirPool* pool = firPoolCreate(0);
+    cl_int status;
+    size_t maxWorkGroup = 0;
+    cl_ulong maxAlloc = 0;
+    clGetDeviceInfo(device[0], CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(maxWorkGroup), &maxWorkGroup, NULL);
+    clGetDeviceInfo(device[0], CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, NULL);
+    size_t kernelWorkGroup = 0;
+    clGetKernelWorkGroupInfo(kernel, device[0], CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelWorkGroup), &kernelWorkGroup, NULL);
+    if(kernelWorkGroup != 0 && kernelWorkGroup < maxWorkGroup)
+        maxWorkGroup = kernelWorkGroup;
+    FirClFilter naiveFilter = { kernel, 0, 0, 0 };
+
+    reportHeader(&report);
+    for(size_t length = minLength; length != 0 && length <= maxLength; length = nextLength(length, maxLength)){
+        short* input = (short*)malloc(sizeof(short) * length);
+        float* output = (float*)malloc(sizeof(float) * length);
+        if(input == NULL || output == NULL){
+            fprintf(stderr, "Out of memory at length %zu\n", length);
+            free(input);
+            free(output);
+            break;
+        }
+        for(size_t i = 0; i < length; i++)
+            input[i] = (short)(rand() % 65536 - 32768);
+
+        const bool deviceFits = length * sizeof(float) <= maxAlloc;
+        cl_mem inputMem = NULL, outputMem = NULL;
+        if(deviceFits && (backends[BENCH_OPENCL] || backends[BENCH_OPENCL_TILED])){
+            inputMem = clCreateBuffer(context, CL_MEM_READ_ONLY, length * sizeof(short), NULL, &status);
+            error(status, "Failed to create the benchmark input buffer");
+            outputMem = clCreateBuffer(context, CL_MEM_WRITE_ONLY, length * sizeof(float), NULL, &status);
+            error(status, "Failed to create the benchmark output buffer");
+        }
+
+        for(size_t t = 0; t < tapsListCount; t++){
+            const size_t tapsCount = tapsList[t];
+            if(tapsCount == 0 || tapsCount > length)
+                continue;
+            float* taps = (float*)malloc(sizeof(float) * tapsCount);
+            for(size_t j = 0; j < tapsCount; j++)
+                taps[j] = rand() / (float)RAND_MAX - 0.5f;
+
+            if(backends[BENCH_SCALAR] && (unsigned long long)length * tapsCount <= BENCH_SCALAR_MAX_MACS)
+                benchCpu(&report, BENCH_SCALAR, pool, input, length, taps, tapsCount, output);
+            if(backends[BENCH_SIMD])
+                benchCpu(&report, BENCH_SIMD, pool, input, length, taps, tapsCount, output);
+            if(backends[BENCH_THREADED])
+                benchCpu(&report, BENCH_THREADED, pool, input, length, taps, tapsCount, output);
+
+            if(inputMem != NULL){
+                cl_mem tapsMem = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(float) * tapsCount, NULL, &status);
+                error(status, "Failed to create the benchmark taps buffer");
+                status = clEnqueueWriteBuffer(queue, tapsMem, CL_TRUE, 0, sizeof(float) * tapsCount, taps, 0, NULL, NULL);
+                error(status, "Failed to write the benchmark taps");
+                if(backends[BENCH_OPENCL]){
+                    for(size_t w = 0; w < sizeof(workGroupSizes) / sizeof(workGroupSizes[0]); w++){
+                        if(workGroupSizes[w] <= maxWorkGroup)
+                            benchOpenCL(&report, BENCH_OPENCL, &env, &naiveFilter, workGroupSizes[w],
+                                        inputMem, outputMem, tapsMem, input, length, tapsCount, output);
+                    }
+                }
+                if(backends[BENCH_OPENCL_TILED]){
+                    FirClFilter tiledFilter;
+                    status = firClCreateFilter(&env, tapsCount, FIR_INPUT_INT16, 0, &tiledFilter);
+                    error(status, "Failed to create the tiled benchmark kernel");
+                    benchOpenCL(&report, BENCH_OPENCL_TILED, &env, &tiledFilter, FIR_CL_LOCAL_SIZE,
+                                inputMem, outputMem, tapsMem, input, length, tapsCount, output);
+                    firClReleaseFilter(&tiledFilter);
+                }
+                clReleaseMemObject(tapsMem);
+            }
+            free(taps);
+        }
+        if(inputMem != NULL)
+            clReleaseMemObject(inputMem);
+        if(outputMem != NULL)
+            clReleaseMemObject(outputMem);
+        free(input);
+        free(output);
+    }
+    reportFooter(&report);
+
+    if(report.out != stdout)
+        fclose(report.out);
+    firPoolDestroy(pool);
+    firClReleaseBuffers();
+    firClReleaseVariants();
+    cleanup();
+    return 0;
+}
@@ -0,0 +1,312 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include "cpu_pool.h"
+#include "cpu_simd.h"
+#include "fir_trace.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+// Task range owned by one worker; the owner pops from begin, thieves cut from end.
+// Padded so neighbouring queues do not share a cache line.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+    char pad[64];
+} FirPoolQueue;
+
+typedef struct {
+    FirPool* pool;
+    unsigned index;
+    int core;                // pinned to this core, -1 = not pinned
+} FirPoolWorker;
+
+struct FirPool {
+    unsigned threads;        // workers running
+    unsigned queueCount;     // workers asked for
+    pthread_t* handles;
+    FirPoolWorker* workers;
+    FirPoolQueue* queues;
+
+    pthread_mutex_t run;     // held for a whole firPoolRun, so concurrent runs queue up
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation;
+    unsigned pending;
+    bool stop;
+
+    FirTask task;
+    void* ctx;
+};
+
+unsigned firPoolCores() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (unsigned)info.dwNumberOfProcessors : 1;
+#else
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (unsigned)cores : 1;
+#endif
+}
+
+// Cores the process may run on (its affinity mask), at most max of them; 0 when unknown
+static unsigned allowedCores(unsigned* cores, unsigned max) {
+    unsigned count = 0;
+#ifdef _WIN32
+    DWORD_PTR process = 0, system = 0;
+    if(GetProcessAffinityMask(GetCurrentProcess(), &process, &system)){
+        for(unsigned core = 0; core < sizeof(DWORD_PTR)*8 && count < max; core++)
+            if(process & ((DWORD_PTR)1 << core))
+                cores[count++] = core;
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) == 0){
+        for(unsigned core = 0; core < CPU_SETSIZE && count < max; core++)
+            if(CPU_ISSET(core, &set))
+                cores[count++] = core;
+    }
+#else
+    (void)cores;
+    (void)max;
+#endif
+    return count;
+}
+
+// Where the next pool starts on the allowed cores, so several pools spread out
+static unsigned nextCore = 0;
+
+static void pinToCore(unsigned core) {
+#ifdef _WIN32
+    if(core < sizeof(DWORD_PTR)*8)
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core);
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)core;
+#endif
+}
+
+static bool popOwn(FirPoolQueue* queue, size_t* task) {
+    bool found = false;
+    pthread_mutex_lock(&queue->lock);
+    if(queue->begin < queue->end){
+        *task = queue->begin++;
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+// Move half of the first non-empty victim's range into our own queue
+static bool steal(FirPool* pool, unsigned self) {
+    for(unsigned k = 1; k < pool->threads; k++){
+        FirPoolQueue* victim = &pool->queues[(self + k) % pool->threads];
+        size_t begin = 0, end = 0;
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->end - victim->begin;
+        if(left > 0){
+            end = victim->end;
+            begin = end - (left + 1)/2;
+            victim->end = begin;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if(end > begin){
+            FirPoolQueue* own = &pool->queues[self];
+            pthread_mutex_lock(&own->lock);
+            own->begin = begin;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void* workerMain(void* arg) {
+    FirPoolWorker* worker = (FirPoolWorker*)arg;
+    FirPool* pool = worker->pool;
+    if(worker->core >= 0)
+        pinToCore((unsigned)worker->core);
+
+    unsigned long seen = 0;
+    for(;;){
+        pthread_mutex_lock(&pool->lock);
+        while(pool->generation == seen && !pool->stop)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if(pool->stop){
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        FirTask task = pool->task;
+        void* ctx = pool->ctx;
+        pthread_mutex_unlock(&pool->lock);
+
+        size_t index;
+        for(;;){
+            if(popOwn(&pool->queues[worker->index], &index))
+                task(ctx, index, worker->index);
+            else if(!steal(pool, worker->index))
+                break;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+FirPool* firPoolCreate(unsigned threads) {
+    if(threads == 0)
+        threads = firPoolCores();
+    FirPool* pool = (FirPool*)calloc(1, sizeof(FirPool));
+    if(pool == NULL)
+        return NULL;
+    pool->threads = threads;
+    pool->queueCount = threads;
+    pool->handles = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    pool->workers = (FirPoolWorker*)calloc(threads, sizeof(FirPoolWorker));
+    pool->queues = (FirPoolQueue*)calloc(threads, sizeof(FirPoolQueue));
+    if(pool->handles == NULL || pool->workers == NULL || pool->queues == NULL){
+        free(pool->handles);
+        free(pool->workers);
+        free(pool->queues);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->run, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    // Resolve the SIMD kernel before any worker can race on it
+    firSimdIsa();
+    for(unsigned i = 0; i < threads; i++)
+        pthread_mutex_init(&pool->queues[i].lock, NULL);
+    // Workers are pinned round the process's allowed cores from a per-pool offset, and only
+    // when they fit: a pool per handle or the scheduler's pool then lands on other cores
+    // than the main one instead of stacking on the first ones.
+    unsigned* cores = (unsigned*)malloc(sizeof(unsigned) * firPoolCores());
+    const unsigned coreCount = cores != NULL ? allowedCores(cores, firPoolCores()) : 0;
+    const unsigned offset = __atomic_fetch_add(&nextCore, threads, __ATOMIC_RELAXED);
+    for(unsigned i = 0; i < threads; i++)
+        pool->workers[i].core = threads <= coreCount ? (int)cores[(offset + i) % coreCount] : -1;
+    free(cores);
+    // A run waits for every worker, so the pool only counts the workers that started
+    unsigned started = 0;
+    for(unsigned i = 0; i < threads; i++){
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if(pthread_create(&pool->handles[i], NULL, workerMain, &pool->workers[i]) != 0)
+            break;
+        started++;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->threads = started;
+    pthread_mutex_unlock(&pool->lock);
+    if(started == 0){
+        firPoolDestroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void firPoolDestroy(FirPool* pool) {
+    if(pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for(unsigned i = 0; i < pool->threads; i++)
+        pthread_join(pool->handles[i], NULL);
+    for(unsigned i = 0; i < pool->queueCount; i++)
+        pthread_mutex_destroy(&pool->queues[i].lock);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->run);
+    free(pool->handles);
+    free(pool->workers);
+    free(pool->queues);
+    free(pool);
+}
+
+unsigned firPoolThreads(const FirPool* pool) {
+    return pool->threads;
+}
+
+void firPoolRun(FirPool* pool, size_t taskCount, FirTask task, void* ctx) {
+    if(taskCount == 0)
+        return;
+    pthread_mutex_lock(&pool->run);
+    // Contiguous initial slices keep neighbouring blocks (and their shared halos) on one core
+    for(unsigned i = 0; i < pool->threads; i++){
+        FirPoolQueue* queue = &pool->queues[i];
+        pthread_mutex_lock(&queue->lock);
+        queue->begin = taskCount * i / pool->threads;
+        queue->end = taskCount * (i + 1) / pool->threads;
+        pthread_mutex_unlock(&queue->lock);
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->ctx = ctx;
+    pool->pending = pool->threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    while(pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->run);
+}
+
+typedef struct {
+    const short* input;
+    const float* taps;
+    float* output;
+    size_t tapsCount;
+    size_t outputCount;
+    size_t blockSize;
+} FilterJob;
+
+static void filterBlock(void* ctx, size_t task, unsigned worker) {
+    (void)worker;
+    const FilterJob* job = (const FilterJob*)ctx;
+    size_t first = task * job->blockSize;
+    size_t count = job->outputCount - first;
+    if(count > job->blockSize)
+        count = job->blockSize;
+    firSimd(job->input + first, count, job->taps, job->tapsCount, job->output + first);
+}
+
+void firPoolFilter(FirPool* pool, const short* input, size_t outputCount,
+                   const float* taps, size_t tapsCount, float* output) {
+    // Per block: outputs*4 bytes written plus (outputs + taps - 1)*2 bytes read
+    size_t blockSize = FIR_POOL_BLOCK_BYTES / (sizeof(float) + sizeof(short));
+    blockSize = blockSize > tapsCount ? blockSize - tapsCount : 64;
+    blockSize = (blockSize + 63) & ~(size_t)63;
+    const uint64_t traceStart = firTraceStart();
+    if(pool == NULL || outputCount <= blockSize){
+        firSimd(input, outputCount, taps, tapsCount, output);
+    }
+    else{
+        FilterJob job = { input, taps, output, tapsCount, outputCount, blockSize };
+        firPoolRun(pool, (outputCount + blockSize - 1) / blockSize, filterBlock, &job);
+    }
+    firTraceCpu("firPoolFilter", traceStart, outputCount);
+}
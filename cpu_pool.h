@@ -0,0 +1,31 @@
+#ifndef CPU_POOL_H
+#define CPU_POOL_H
+#include <stddef.h>
+
+// Output block handed to one worker: its int16 inputs plus float outputs stay around
+// this many bytes so a block lives in L2 while the taps sweep over it
+#define FIR_POOL_BLOCK_BYTES (128*1024)
+
+typedef struct FirPool FirPool;
+typedef void (*FirTask)(void* ctx, size_t task, unsigned worker);
+
+// threads == 0 starts one worker per online core. When the workers fit in the process's
+// CPU affinity mask they are pinned to its cores, each pool starting where the previous
+// one ended, so separate pools spread over the allowed cores. When some workers cannot
+// be started the pool runs with those that did (see firPoolThreads); NULL when none could.
+FirPool* firPoolCreate(unsigned threads);
+void firPoolDestroy(FirPool* pool);
+unsigned firPoolThreads(const FirPool* pool);
+unsigned firPoolCores();
+
+// Run task(ctx, 0..taskCount-1) on the workers and wait. Each worker starts on its own
+// contiguous slice and steals half of a busy neighbour's remaining slice when it runs dry.
+// Runs from several threads on one pool take turns; a task must not call firPoolRun
+// on its own pool.
+void firPoolRun(FirPool* pool, size_t taskCount, FirTask task, void* ctx);
+
+// Parallel firSimd: the output range is cut into FIR_POOL_BLOCK_BYTES blocks, and each
+// block reads its tapsCount-1 halo samples straight from the start of the next block's input.
+void firPoolFilter(FirPool* pool, const short* input, size_t outputCount,
+                   const float* taps, size_t tapsCount, float* output);
+#endif // CPU_POOL_H
@@ -0,0 +1,411 @@
+#include "cpu_simd.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FIR_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*FirKernel)(const short*, size_t, const float*, size_t, float*);
+
+static void firScalar(const short* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) {
+    for(size_t i = 0; i < outputCount; i++){
+        float sum = 0;
+        for(size_t j = 0; j < tapsCount; j++){
+            sum += input[i+j] * taps[j];
+        }
+        output[i] = sum;
+    }
+}
+
+#ifdef FIR_SIMD_X86
+// Every kernel keeps four vector accumulators in flight (16/32/64 outputs per block)
+// so consecutive multiply-adds do not wait on each other. Samples are loaded as int16
+// and widened to float in registers, one unaligned load per tap.
+
+__attribute__((target("sse4.2")))
+static void firSse42(const short* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) {
+    size_t i = 0;
+    for(; i + 16 <= outputCount; i += 16){
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+        __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+        const short* x = input + i;
+        for(size_t j = 0; j < tapsCount; j++){
+            const __m128 t = _mm_set1_ps(taps[j]);
+            const __m128i lo = _mm_loadu_si128((const __m128i*)(x + j));
+            const __m128i hi = _mm_loadu_si128((const __m128i*)(x + j + 8));
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(lo)), t));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(lo, 8))), t));
+            acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(hi)), t));
+            acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(hi, 8))), t));
+        }
+        _mm_storeu_ps(output + i, acc0);
+        _mm_storeu_ps(output + i + 4, acc1);
+        _mm_storeu_ps(output + i + 8, acc2);
+        _mm_storeu_ps(output + i + 12, acc3);
+    }
+    for(; i + 4 <= outputCount; i += 4){
+        __m128 acc = _mm_setzero_ps();
+        for(size_t j = 0; j < tapsCount; j++){
+            const __m128i v = _mm_loadl_epi64((const __m128i*)(input + i + j));
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepi16_epi32(v)), _mm_set1_ps(taps[j])));
+        }
+        _mm_storeu_ps(output + i, acc);
+    }
+    firScalar(input + i, outputCount - i, taps, tapsCount, output + i);
+}
+
+// The AVX2 and AVX-512 bodies are inlined into one generic kernel and into fixed tap-count
+// instances (FIR_FIXED_TAPS), where the constant bound lets the tap loop unroll fully.
+#define FIR_UNROLL _Pragma("GCC unroll 16")
+
+static inline __attribute__((always_inline, target("avx2,fma")))
+void avx2Body(const short* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) {
+    size_t i = 0;
+    for(; i + 32 <= outputCount; i += 32){
+        __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+        __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+        const short* x = input + i;
+        FIR_UNROLL
+        for(size_t j = 0; j < tapsCount; j++){
+            const __m256 t = _mm256_broadcast_ss(taps + j);
+            const __m256 x0 = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(x + j))));
+            const __m256 x1 = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(x + j + 8))));
+            const __m256 x2 = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(x + j + 16))));
+            const __m256 x3 = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(x + j + 24))));
+            acc0 = _mm256_fmadd_ps(x0, t, acc0);
+            acc1 = _mm256_fmadd_ps(x1, t, acc1);
+            acc2 = _mm256_fmadd_ps(x2, t, acc2);
+            acc3 = _mm256_fmadd_ps(x3, t, acc3);
+        }
+        _mm256_storeu_ps(output + i, acc0);
+        _mm256_storeu_ps(output + i + 8, acc1);
+        _mm256_storeu_ps(output + i + 16, acc2);
+        _mm256_storeu_ps(output + i + 24, acc3);
+    }
+    for(; i + 8 <= outputCount; i += 8){
+        __m256 acc = _mm256_setzero_ps();
+        FIR_UNROLL
+        for(size_t j = 0; j < tapsCount; j++){
+            const __m256 x0 = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(input + i + j))));
+            acc = _mm256_fmadd_ps(x0, _mm256_broadcast_ss(taps + j), acc);
+        }
+        _mm256_storeu_ps(output + i, acc);
+    }
+    firScalar(input + i, outputCount - i, taps, tapsCount, output + i);
+}
+
+static inline __attribute__((always_inline, target("avx512f,avx512bw,avx2,fma")))
+void avx512Body(const short* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) {
+    size_t i = 0;
+    for(; i + 64 <= outputCount; i += 64){
+        __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+        __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+        const short* x = input + i;
+        FIR_UNROLL
+        for(size_t j = 0; j < tapsCount; j++){
+            const __m512 t = _mm512_set1_ps(taps[j]);
+            const __m512 x0 = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(x + j))));
+            const __m512 x1 = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(x + j + 16))));
+            const __m512 x2 = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(x + j + 32))));
+            const __m512 x3 = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)(x + j + 48))));
+            acc0 = _mm512_fmadd_ps(x0, t, acc0);
+            acc1 = _mm512_fmadd_ps(x1, t, acc1);
+            acc2 = _mm512_fmadd_ps(x2, t, acc2);
+            acc3 = _mm512_fmadd_ps(x3, t, acc3);
+        }
+        _mm512_storeu_ps(output + i, acc0);
+        _mm512_storeu_ps(output + i + 16, acc1);
+        _mm512_storeu_ps(output + i + 32, acc2);
+        _mm512_storeu_ps(output + i + 48, acc3);
+    }
+    // Remaining < 64 outputs go through the AVX2 blocks
+    avx2Body(input + i, outputCount - i, taps, tapsCount, output + i);
+}
+
+__attribute__((target("avx2,fma")))
+static void firAvx2(const short* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) {
+    avx2Body(input, outputCount, taps, tapsCount, output);
+}
+
+__attribute__((target("avx512f,avx512bw,avx2,fma")))
+static void firAvx512(const short* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) {
+    avx512Body(input, outputCount, taps, tapsCount, output);
+}
+
+#define FIR_FIXED_TAPS(N) \
+    __attribute__((target("avx2,fma"))) \
+    static void firAvx2Taps##N(const short* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) { \
+        (void)tapsCount; \
+        avx2Body(input, outputCount, taps, N, output); \
+    } \
+    __attribute__((target("avx512f,avx512bw,avx2,fma"))) \
+    static void firAvx512Taps##N(const short* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) { \
+        (void)tapsCount; \
+        avx512Body(input, outputCount, taps, N, output); \
+    }
+
+FIR_FIXED_TAPS(8)
+FIR_FIXED_TAPS(16)
+FIR_FIXED_TAPS(32)
+FIR_FIXED_TAPS(64)
+
+// Fixed instance for tapsCount on the active ISA, or NULL
+static FirKernel fixedKernel(FirIsa isa, size_t tapsCount) {
+    if(isa < FIR_ISA_AVX2)
+        return NULL;
+    const bool wide = isa == FIR_ISA_AVX512;
+    switch(tapsCount){
+    case 8:  return wide ? firAvx512Taps8  : firAvx2Taps8;
+    case 16: return wide ? firAvx512Taps16 : firAvx2Taps16;
+    case 32: return wide ? firAvx512Taps32 : firAvx2Taps32;
+    case 64: return wide ? firAvx512Taps64 : firAvx2Taps64;
+    default: return NULL;
+    }
+}
+#endif // FIR_SIMD_X86
+
+static FirIsa detectIsa() {
+#ifdef FIR_SIMD_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return FIR_ISA_AVX512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return FIR_ISA_AVX2;
+    if(__builtin_cpu_supports("sse4.2"))
+        return FIR_ISA_SSE42;
+#endif
+    return FIR_ISA_SCALAR;
+}
+
+static FirKernel isaKernel(FirIsa isa) {
+#ifdef FIR_SIMD_X86
+    switch(isa){
+    case FIR_ISA_AVX512: return firAvx512;
+    case FIR_ISA_AVX2:   return firAvx2;
+    case FIR_ISA_SSE42:  return firSse42;
+    default:             return firScalar;
+    }
+#else
+    (void)isa;
+    return firScalar;
+#endif
+}
+
+// The detected ISA is the same for every thread, so racing first detections agree. The
+// active one can change under running filters (firSimdSetIsa), hence the atomic accesses;
+// -1 until the first call.
+static int supportedIsa = -1;
+static int activeIsa = -1;
+
+void firSimdSetIsa(FirIsa isa) {
+    int supported = __atomic_load_n(&supportedIsa, __ATOMIC_RELAXED);
+    if(supported < 0){
+        supported = (int)detectIsa();
+        __atomic_store_n(&supportedIsa, supported, __ATOMIC_RELAXED);
+    }
+    if((int)isa > supported)
+        isa = (FirIsa)supported;
+    __atomic_store_n(&activeIsa, (int)isa, __ATOMIC_RELAXED);
+}
+
+FirIsa firSimdIsa() {
+    int isa = __atomic_load_n(&activeIsa, __ATOMIC_RELAXED);
+    if(isa < 0){
+        // First call: the best supported, unless a concurrent firSimdSetIsa got there first
+        const int supported = (int)detectIsa();
+        __atomic_store_n(&supportedIsa, supported, __ATOMIC_RELAXED);
+        if(__atomic_compare_exchange_n(&activeIsa, &isa, supported, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            isa = supported;
+    }
+    return (FirIsa)isa;
+}
+
+const char* firSimdIsaName(FirIsa isa) {
+    switch(isa){
+    case FIR_ISA_AVX512: return "AVX-512";
+    case FIR_ISA_AVX2:   return "AVX2+FMA";
+    case FIR_ISA_SSE42:  return "SSE4.2";
+    default:             return "scalar";
+    }
+}
+
+void firSimd(const short* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) {
+    // One load, so the kernel and its fixed-tap instance always come from the same ISA
+    const FirIsa isa = firSimdIsa();
+#ifdef FIR_SIMD_X86
+    FirKernel fixed = fixedKernel(isa, tapsCount);
+    if(fixed){
+        fixed(input, outputCount, taps, tapsCount, output);
+        return;
+    }
+#endif
+    isaKernel(isa)(input, outputCount, taps, tapsCount, output);
+}
+
+float firSimdCheck(const short* input, size_t outputCount, const float* taps, size_t tapsCount,
+                   const float* output, const float* reference) {
+    float worst = 0;
+    for(size_t i = 0; i < outputCount; i++){
+        float magnitude = 0;
+        for(size_t j = 0; j < tapsCount; j++){
+            magnitude += fabsf(input[i+j] * taps[j]);
+        }
+        const float bound = FIR_SIMD_REL_TOLERANCE * magnitude + 1e-30f;
+        const float ratio = fabsf(output[i] - reference[i]) / bound;
+        if(ratio > worst)
+            worst = ratio;
+    }
+    return worst;
+}
+
+// Q15 kernels. Taps go in as int32 pairs (tap j in the low half, tap j+1 in the high half);
+// interleaving x[i+j..] with x[i+j+1..] lines up one output per int32 lane, so pmaddwd
+// yields x[i+j]*taps[j] + x[i+j+1]*taps[j+1] for several outputs at once. An odd last tap
+// is paired with zero and never reads past the input.
+
+static short q15Output(uint32_t acc) {
+    // Wrapping add then arithmetic shift, exactly what paddd + psrad do
+    const int32_t value = (int32_t)(acc + (1u << (FIR_Q15_SHIFT - 1))) >> FIR_Q15_SHIFT;
+    return (short)(value > 32767 ? 32767 : value < -32768 ? -32768 : value);
+}
+
+static void firQ15Scalar(const short* input, size_t outputCount, const short* taps, size_t tapsCount, short* output) {
+    for(size_t i = 0; i < outputCount; i++){
+        uint32_t acc = 0;
+        for(size_t j = 0; j < tapsCount; j++){
+            acc += (uint32_t)(input[i+j] * taps[j]);
+        }
+        output[i] = q15Output(acc);
+    }
+}
+
+#ifdef FIR_SIMD_X86
+__attribute__((target("sse4.2")))
+static void firQ15Sse42(const short* input, size_t outputCount, const short* taps, const int32_t* pairs,
+                        size_t tapsCount, short* output) {
+    const __m128i round = _mm_set1_epi32(1 << (FIR_Q15_SHIFT - 1));
+    size_t i = 0;
+    for(; i + 8 <= outputCount; i += 8){
+        __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        const short* x = input + i;
+        size_t j = 0;
+        for(; j + 2 <= tapsCount; j += 2){
+            const __m128i t = _mm_set1_epi32(pairs[j / 2]);
+            const __m128i a = _mm_loadu_si128((const __m128i*)(x + j));
+            const __m128i b = _mm_loadu_si128((const __m128i*)(x + j + 1));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), t));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), t));
+        }
+        if(j < tapsCount){
+            const __m128i t = _mm_set1_epi32(pairs[j / 2]);
+            const __m128i a = _mm_loadu_si128((const __m128i*)(x + j));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, _mm_setzero_si128()), t));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, _mm_setzero_si128()), t));
+        }
+        lo = _mm_srai_epi32(_mm_add_epi32(lo, round), FIR_Q15_SHIFT);
+        hi = _mm_srai_epi32(_mm_add_epi32(hi, round), FIR_Q15_SHIFT);
+        _mm_storeu_si128((__m128i*)(output + i), _mm_packs_epi32(lo, hi));
+    }
+    firQ15Scalar(input + i, outputCount - i, taps, tapsCount, output + i);
+}
+
+// 256/512-bit unpacks work per 128-bit lane, so lo/hi hold outputs 0-3/4-7 of every
+// lane; packs also works per lane and puts them back in order.
+__attribute__((target("avx2")))
+static void firQ15Avx2(const short* input, size_t outputCount, const short* taps, const int32_t* pairs,
+                       size_t tapsCount, short* output) {
+    const __m256i round = _mm256_set1_epi32(1 << (FIR_Q15_SHIFT - 1));
+    size_t i = 0;
+    for(; i + 16 <= outputCount; i += 16){
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+        const short* x = input + i;
+        size_t j = 0;
+        for(; j + 2 <= tapsCount; j += 2){
+            const __m256i t = _mm256_set1_epi32(pairs[j / 2]);
+            const __m256i a = _mm256_loadu_si256((const __m256i*)(x + j));
+            const __m256i b = _mm256_loadu_si256((const __m256i*)(x + j + 1));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), t));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), t));
+        }
+        if(j < tapsCount){
+            const __m256i t = _mm256_set1_epi32(pairs[j / 2]);
+            const __m256i a = _mm256_loadu_si256((const __m256i*)(x + j));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, _mm256_setzero_si256()), t));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, _mm256_setzero_si256()), t));
+        }
+        lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), FIR_Q15_SHIFT);
+        hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), FIR_Q15_SHIFT);
+        _mm256_storeu_si256((__m256i*)(output + i), _mm256_packs_epi32(lo, hi));
+    }
+    firQ15Sse42(input + i, outputCount - i, taps, pairs, tapsCount, output + i);
+}
+
+__attribute__((target("avx512f,avx512bw,avx2")))
+static void firQ15Avx512(const short* input, size_t outputCount, const short* taps, const int32_t* pairs,
+                         size_t tapsCount, short* output) {
+    const __m512i round = _mm512_set1_epi32(1 << (FIR_Q15_SHIFT - 1));
+    size_t i = 0;
+    for(; i + 32 <= outputCount; i += 32){
+        __m512i lo = _mm512_setzero_si512(), hi = _mm512_setzero_si512();
+        const short* x = input + i;
+        size_t j = 0;
+        for(; j + 2 <= tapsCount; j += 2){
+            const __m512i t = _mm512_set1_epi32(pairs[j / 2]);
+            const __m512i a = _mm512_loadu_si512((const void*)(x + j));
+            const __m512i b = _mm512_loadu_si512((const void*)(x + j + 1));
+            lo = _mm512_add_epi32(lo, _mm512_madd_epi16(_mm512_unpacklo_epi16(a, b), t));
+            hi = _mm512_add_epi32(hi, _mm512_madd_epi16(_mm512_unpackhi_epi16(a, b), t));
+        }
+        if(j < tapsCount){
+            const __m512i t = _mm512_set1_epi32(pairs[j / 2]);
+            const __m512i a = _mm512_loadu_si512((const void*)(x + j));
+            lo = _mm512_add_epi32(lo, _mm512_madd_epi16(_mm512_unpacklo_epi16(a, _mm512_setzero_si512()), t));
+            hi = _mm512_add_epi32(hi, _mm512_madd_epi16(_mm512_unpackhi_epi16(a, _mm512_setzero_si512()), t));
+        }
+        lo = _mm512_srai_epi32(_mm512_add_epi32(lo, round), FIR_Q15_SHIFT);
+        hi = _mm512_srai_epi32(_mm512_add_epi32(hi, round), FIR_Q15_SHIFT);
+        _mm512_storeu_si512((void*)(output + i), _mm512_packs_epi32(lo, hi));
+    }
+    firQ15Avx2(input + i, outputCount - i, taps, pairs, tapsCount, output + i);
+}
+#endif // FIR_SIMD_X86
+
+void firQ15Taps(const float* taps, size_t tapsCount, short* q15) {
+    for(size_t j = 0; j < tapsCount; j++){
+        const float scaled = roundf(taps[j] * (float)(1 << FIR_Q15_SHIFT));
+        q15[j] = (short)(scaled > 32767.0f ? 32767 : scaled < -32768.0f ? -32768 : scaled);
+    }
+}
+
+void firSimdQ15(const short* input, size_t outputCount, const short* taps, size_t tapsCount, short* output) {
+    const FirIsa isa = firSimdIsa();
+#ifdef FIR_SIMD_X86
+    if(isa != FIR_ISA_SCALAR){
+        // The pair table sits on the stack up to FIR_Q15_STACK_TAPS taps
+        int32_t stackPairs[FIR_Q15_STACK_TAPS / 2];
+        const size_t pairCount = (tapsCount + 1) / 2;
+        int32_t* pairs = pairCount <= FIR_Q15_STACK_TAPS / 2 ? stackPairs : (int32_t*)malloc(sizeof(int32_t) * pairCount);
+        if(pairs != NULL){
+            for(size_t j = 0; j < tapsCount; j += 2){
+                const uint16_t high = j + 1 < tapsCount ? (uint16_t)taps[j+1] : 0;
+                pairs[j / 2] = (int32_t)((uint32_t)(uint16_t)taps[j] | (uint32_t)high << 16);
+            }
+            switch(isa){
+            case FIR_ISA_AVX512: firQ15Avx512(input, outputCount, taps, pairs, tapsCount, output); break;
+            case FIR_ISA_AVX2:   firQ15Avx2(input, outputCount, taps, pairs, tapsCount, output);   break;
+            default:             firQ15Sse42(input, outputCount, taps, pairs, tapsCount, output);  break;
+            }
+            if(pairs != stackPairs)
+                free(pairs);
+            return;
+        }
+    }
+#endif
+    // Scalar ISA, or no memory for a long pair table
+    (void)isa;
+    firQ15Scalar(input, outputCount, taps, tapsCount, output);
+}
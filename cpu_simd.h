@@ -0,0 +1,43 @@
+#ifndef CPU_SIMD_H
+#define CPU_SIMD_H
+#include <stddef.h>
+
+// Instruction sets the CPU engine can dispatch to, best last
+typedef enum {
+    FIR_ISA_SCALAR = 0,
+    FIR_ISA_SSE42,
+    FIR_ISA_AVX2,
+    FIR_ISA_AVX512
+} FirIsa;
+
+// The SIMD kernels sum the taps in a different order than cpuFilter and
+// the AVX2/AVX-512 ones use fused multiply-add, so results are not bit-exact.
+// For every output |simd - scalar| <= FIR_SIMD_REL_TOLERANCE * sum(|input*taps|).
+#define FIR_SIMD_REL_TOLERANCE (1e-5f)
+
+// Filter outputCount samples: output[i] = sum(input[i+j] * taps[j]).
+// input must hold outputCount + tapsCount - 1 samples.
+void firSimd(const short* input, size_t outputCount, const float* taps, size_t tapsCount, float* output);
+
+FirIsa firSimdIsa();
+const char* firSimdIsaName(FirIsa isa);
+// Force a kernel (for benchmarking); an ISA the CPU lacks falls back to the best supported.
+// Safe while other threads filter: each call picks up the ISA active when it starts.
+void firSimdSetIsa(FirIsa isa);
+// Largest deviation of output from reference, relative to the tolerance bound (<= 1 passes)
+float firSimdCheck(const short* input, size_t outputCount, const float* taps, size_t tapsCount,
+                   const float* output, const float* reference);
+
+// Q15 fixed point: taps hold value * 2^15, each output is the int32 sum of input*taps,
+// rounded, shifted back by FIR_Q15_SHIFT and saturated to int16. All ISAs give
+// bit-identical results. The int32 sum is exact while sum(|taps|) < 2^16, i.e. for
+// filters with an L1 gain below 2, and wraps beyond that.
+#define FIR_Q15_SHIFT 15
+// firSimdQ15 keeps its tap-pair table on the stack up to this many taps, on the heap beyond
+#define FIR_Q15_STACK_TAPS 1024
+
+// Round float taps to Q15, saturating at [-1, 1)
+void firQ15Taps(const float* taps, size_t tapsCount, short* q15);
+// Filter outputCount samples on the active ISA (x86: pmaddwd dot products of tap pairs)
+void firSimdQ15(const short* input, size_t outputCount, const short* taps, size_t tapsCount, short* output);
+#endif // CPU_SIMD_H
@@ -0,0 +1,12 @@
+TEMPLATE = app
+TARGET = fir-bench
+CONFIG += console c++17 opencl
+CONFIG -= app_bundle
+
+include(fir-filter.pri)
+
+SOURCES += \
+        bench.c
+
+DISTFILES += \
+    kernel.cl
@@ -0,0 +1,58 @@
+# Filter engines shared by the fir-filter demo and the fir-bench sweep
+SOURCES += \
+        cpu_pool.c \
+        cpu_simd.c \
+        fir_batch.c \
+        fir_buffer.c \
+        fir_cache.c \
+        fir_chain.c \
+        fir_cl.c \
+        fir_fft.c \
+        fir_file.c \
+        fir_filter.c \
+        fir_multirate.c \
+        fir_pipeline.c \
+        fir_plan.c \
+        fir_sched.c \
+        fir_stream.c \
+        fir_trace.c \
+        fir_tune.c \
+        global.c \
+        kernel_source.c
+
+HEADERS += \
+    cpu_pool.h \
+    cpu_simd.h \
+    fir_batch.h \
+    fir_buffer.h \
+    fir_cache.h \
+    fir_chain.h \
+    fir_cl.h \
+    fir_fft.h \
+    fir_file.h \
+    fir_filter.h \
+    fir_multirate.h \
+    fir_pipeline.h \
+    fir_plan.h \
+    fir_sched.h \
+    fir_stream.h \
+    fir_trace.h \
+    fir_tune.h \
+    global.h
+
+#LIBS += -lOpenCL
+LIBS += -lpthread
+
+# Link kernel.cl into the executable (kernel_source.c) so startup needs no file lookup;
+# drop FIR_EMBED_KERNEL to load KERNEL_PATH at run time instead
+DEFINES += FIR_EMBED_KERNEL
+QMAKE_CFLAGS += -Wa,-I$$PWD
+# The .incbin is invisible to dependency scanning: rebuild the object when the kernel changes
+kernel_embed.target = $${OBJECTS_DIR}kernel_source.o
+kernel_embed.depends = $$PWD/kernel.cl
+QMAKE_EXTRA_TARGETS += kernel_embed
+
+win32: LIBS += -L$$PWD/../OpenCL/OpenCL-SDK-v2023.04.17-Win-x64/lib/ -lOpenCL
+
+INCLUDEPATH += $$PWD/../OpenCL/OpenCL-SDK-v2023.04.17-Win-x64/include
+DEPENDPATH += $$PWD/../OpenCL/OpenCL-SDK-v2023.04.17-Win-x64/include
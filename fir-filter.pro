@@ -2,19 +2,13 @@ TEMPLATE = app
 CONFIG += console c++17 opencl
 CONFIG -= app_bundle
 #QT += opencl
+include(fir-filter.pri)
+
 SOURCES += \
-        global.c \
         main.c
 
 
 
-HEADERS += \
-    global.h
-
-#LIBS += -lOpenCL
-
-
-
 #unix|win32: LIBS += -L$$PWD/'../NVIDIA GPU Computing SDK/OpenCL/common/lib/x64/' -lOpenCL
 
 #INCLUDEPATH += $$PWD/'../NVIDIA GPU Computing SDK/OpenCL/common/lib/x64'
@@ -37,8 +31,3 @@ DISTFILES += \
 #INCLUDEPATH += $$PWD/../OpenCL-SDK-v2023.04.17-Win-x64/include
 #DEPENDPATH += $$PWD/../OpenCL-SDK-v2023.04.17-Win-x64/include
 
-
-win32: LIBS += -L$$PWD/../OpenCL/OpenCL-SDK-v2023.04.17-Win-x64/lib/ -lOpenCL
-
-INCLUDEPATH += $$PWD/../OpenCL/OpenCL-SDK-v2023.04.17-Win-x64/include
-DEPENDPATH += $$PWD/../OpenCL/OpenCL-SDK-v2023.04.17-Win-x64/include
@@ -0,0 +1,199 @@
+#include "fir_batch.h"
+#include "cpu_simd.h"
+#include "fir_trace.h"
+#include <string.h>
+
+// Channels per vector, and outputs accumulated together so each tap load is reused
+#define FIR_BATCH_LANES 8
+#define FIR_BATCH_OUTPUTS 4
+// Samples per transpose tile in firBatchInterleave/firBatchDeinterleave
+#define FIR_BATCH_TILE 64
+
+typedef float FirBatchLanes __attribute__((vector_size(FIR_BATCH_LANES * sizeof(float))));
+typedef short FirBatchShorts __attribute__((vector_size(FIR_BATCH_LANES * sizeof(short))));
+
+cl_int firClCreateBatchFilter(const FirClEnv* env, FirClFilter* filter) {
+    cl_int status;
+    filter->kernel = clCreateKernel(env->program, "FirFilterBatch", &status);
+    filter->outputsPerItem = 0;
+    filter->localSize = 0;
+    filter->tapsCount = 0;
+    return status;
+}
+
+cl_int firClEnqueueBatch(const FirClEnv* env, const FirClFilter* filter, cl_mem input, cl_mem output, cl_mem taps,
+                         cl_uint tapsCount, cl_uint outputCount, cl_uint channels, bool perChannel, cl_event* event) {
+    cl_int status;
+    cl_kernel kernel = filter->kernel;
+    const cl_uint inputStride = outputCount + tapsCount - 1;
+    const cl_uint tapsStride = perChannel ? tapsCount : 0;
+    status  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+    status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
+    status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &taps);
+    status |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &tapsCount);
+    status |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &outputCount);
+    status |= clSetKernelArg(kernel, 5, sizeof(cl_uint), &inputStride);
+    status |= clSetKernelArg(kernel, 6, sizeof(cl_uint), &outputCount);
+    status |= clSetKernelArg(kernel, 7, sizeof(cl_uint), &tapsStride);
+    if(status != CL_SUCCESS)
+        return status;
+    if(outputCount == 0 || channels == 0)
+        return CL_SUCCESS;
+    const size_t localSize = filter->localSize ? filter->localSize : FIR_CL_LOCAL_SIZE;
+    size_t local_work_size[2] = {localSize, 1};
+    size_t global_work_size[2] = {((size_t)outputCount + localSize - 1) / localSize * localSize, channels};
+    FirTraceCall trace;
+    status = clEnqueueNDRangeKernel(env->queue, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL,
+                                    firTraceBegin(&trace, event));
+    firTraceEnd(&trace, event, FIR_TRACE_KERNEL, "FirFilterBatch", status, 0, (size_t)outputCount * channels);
+    return status;
+}
+
+// Vectors go through pointers: returning them by value changes the ABI between ISAs
+static inline __attribute__((always_inline))
+void loadLanes(FirBatchLanes* lanes, const short* samples) {
+    FirBatchShorts s;
+    memcpy(&s, samples, sizeof(s));
+    *lanes = __builtin_convertvector(s, FirBatchLanes);
+}
+
+static inline __attribute__((always_inline))
+void tapLanes(FirBatchLanes* lanes, const float* taps, size_t j, size_t channels, size_t c, bool perChannel) {
+    if(perChannel)
+        memcpy(lanes, taps + j*channels + c, sizeof(*lanes));
+    else
+        *lanes = (FirBatchLanes){0} + taps[j];
+}
+
+// Outputs [first, first + outputCount) of every channel
+static inline __attribute__((always_inline))
+void batchBody(const short* input, size_t channels, size_t first, size_t outputCount,
+               const float* taps, size_t tapsCount, bool perChannel, float* output) {
+    const size_t end = first + outputCount;
+    const size_t vectorChannels = channels - channels % FIR_BATCH_LANES;
+    for(size_t c = 0; c < vectorChannels; c += FIR_BATCH_LANES){
+        size_t i = first;
+        for(; i + FIR_BATCH_OUTPUTS <= end; i += FIR_BATCH_OUTPUTS){
+            FirBatchLanes acc[FIR_BATCH_OUTPUTS] = {{0}};
+            const short* x = input + i*channels + c;
+            for(size_t j = 0; j < tapsCount; j++){
+                FirBatchLanes h, v;
+                tapLanes(&h, taps, j, channels, c, perChannel);
+                for(size_t k = 0; k < FIR_BATCH_OUTPUTS; k++){
+                    loadLanes(&v, x + (j + k)*channels);
+                    acc[k] += v * h;
+                }
+            }
+            for(size_t k = 0; k < FIR_BATCH_OUTPUTS; k++)
+                memcpy(output + (i + k)*channels + c, &acc[k], sizeof(acc[k]));
+        }
+        for(; i < end; i++){
+            FirBatchLanes acc = {0};
+            const short* x = input + i*channels + c;
+            for(size_t j = 0; j < tapsCount; j++){
+                FirBatchLanes h, v;
+                tapLanes(&h, taps, j, channels, c, perChannel);
+                loadLanes(&v, x + j*channels);
+                acc += v * h;
+            }
+            memcpy(output + i*channels + c, &acc, sizeof(acc));
+        }
+    }
+    // Channels left over past the last full vector
+    for(size_t c = vectorChannels; c < channels; c++){
+        for(size_t i = first; i < end; i++){
+            float sum = 0;
+            for(size_t j = 0; j < tapsCount; j++)
+                sum += input[(i + j)*channels + c] * taps[perChannel ? j*channels + c : j];
+            output[i*channels + c] = sum;
+        }
+    }
+}
+
+static void batchGeneric(const short* input, size_t channels, size_t first, size_t outputCount,
+                         const float* taps, size_t tapsCount, bool perChannel, float* output) {
+    batchBody(input, channels, first, outputCount, taps, tapsCount, perChannel, output);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+static void batchAvx2(const short* input, size_t channels, size_t first, size_t outputCount,
+                      const float* taps, size_t tapsCount, bool perChannel, float* output) {
+    batchBody(input, channels, first, outputCount, taps, tapsCount, perChannel, output);
+}
+#endif
+
+static void batchRange(const short* input, size_t channels, size_t first, size_t outputCount,
+                       const float* taps, size_t tapsCount, bool perChannel, float* output) {
+#if defined(__x86_64__) || defined(__i386__)
+    if(firSimdIsa() >= FIR_ISA_AVX2){
+        batchAvx2(input, channels, first, outputCount, taps, tapsCount, perChannel, output);
+        return;
+    }
+#endif
+    batchGeneric(input, channels, first, outputCount, taps, tapsCount, perChannel, output);
+}
+
+void firBatch(const short* input, size_t channels, size_t outputCount,
+              const float* taps, size_t tapsCount, bool perChannel, float* output) {
+    batchRange(input, channels, 0, outputCount, taps, tapsCount, perChannel, output);
+}
+
+typedef struct {
+    const short* input;
+    const float* taps;
+    float* output;
+    size_t channels;
+    size_t tapsCount;
+    size_t outputCount;
+    size_t blockSize;
+    bool perChannel;
+} BatchJob;
+
+static void batchBlock(void* ctx, size_t task, unsigned worker) {
+    (void)worker;
+    const BatchJob* job = (const BatchJob*)ctx;
+    const size_t first = task * job->blockSize;
+    size_t count = job->outputCount - first;
+    if(count > job->blockSize)
+        count = job->blockSize;
+    batchRange(job->input, job->channels, first, count, job->taps, job->tapsCount, job->perChannel, job->output);
+}
+
+void firPoolBatch(FirPool* pool, const short* input, size_t channels, size_t outputCount,
+                  const float* taps, size_t tapsCount, bool perChannel, float* output) {
+    // Same block budget as firPoolFilter, shared by all channels of a sample
+    size_t blockSize = FIR_POOL_BLOCK_BYTES / ((sizeof(float) + sizeof(short)) * (channels ? channels : 1));
+    if(blockSize < FIR_BATCH_OUTPUTS)
+        blockSize = FIR_BATCH_OUTPUTS;
+    blockSize = (blockSize + FIR_BATCH_OUTPUTS - 1) / FIR_BATCH_OUTPUTS * FIR_BATCH_OUTPUTS;
+    const uint64_t traceStart = firTraceStart();
+    if(pool == NULL || outputCount <= blockSize){
+        firBatch(input, channels, outputCount, taps, tapsCount, perChannel, output);
+    }
+    else{
+        BatchJob job = { input, taps, output, channels, tapsCount, outputCount, blockSize, perChannel };
+        firPoolRun(pool, (outputCount + blockSize - 1) / blockSize, batchBlock, &job);
+    }
+    firTraceCpu("firPoolBatch", traceStart, outputCount * channels);
+}
+
+void firBatchInterleave(const short* planar, size_t channels, size_t samples, short* interleaved) {
+    for(size_t s0 = 0; s0 < samples; s0 += FIR_BATCH_TILE){
+        const size_t s1 = s0 + FIR_BATCH_TILE < samples ? s0 + FIR_BATCH_TILE : samples;
+        for(size_t c = 0; c < channels; c++){
+            for(size_t s = s0; s < s1; s++)
+                interleaved[s*channels + c] = planar[c*samples + s];
+        }
+    }
+}
+
+void firBatchDeinterleave(const float* interleaved, size_t channels, size_t samples, float* planar) {
+    for(size_t s0 = 0; s0 < samples; s0 += FIR_BATCH_TILE){
+        const size_t s1 = s0 + FIR_BATCH_TILE < samples ? s0 + FIR_BATCH_TILE : samples;
+        for(size_t c = 0; c < channels; c++){
+            for(size_t s = s0; s < s1; s++)
+                planar[c*samples + s] = interleaved[s*channels + c];
+        }
+    }
+}
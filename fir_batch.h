@@ -0,0 +1,34 @@
+#ifndef FIR_BATCH_H
+#define FIR_BATCH_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu_pool.h"
+#include "fir_cl.h"
+
+// Many channels filtered at once, each with outputCount outputs from
+// outputCount + tapsCount - 1 inputs. Taps are either one set shared by every
+// channel or one set per channel.
+
+// OpenCL: one 2D launch of FirFilterBatch over a planar channels x samples matrix.
+// input holds channels rows of outputCount + tapsCount - 1 int16 samples, output
+// channels rows of outputCount floats, taps tapsCount floats (shared) or channels
+// rows of tapsCount floats (perChannel).
+cl_int firClCreateBatchFilter(const FirClEnv* env, FirClFilter* filter);
+cl_int firClEnqueueBatch(const FirClEnv* env, const FirClFilter* filter, cl_mem input, cl_mem output, cl_mem taps,
+                         cl_uint tapsCount, cl_uint outputCount, cl_uint channels, bool perChannel, cl_event* event);
+
+// CPU: interleaved layout, sample i of channel c at [i*channels + c], so one vector
+// holds the same sample of consecutive channels and the tap loop runs across channels.
+// input holds (outputCount + tapsCount - 1) * channels samples, output
+// outputCount * channels floats, taps tapsCount floats (shared) or tapsCount * channels
+// (perChannel, interleaved the same way: tap j of channel c at [j*channels + c]).
+void firBatch(const short* input, size_t channels, size_t outputCount,
+              const float* taps, size_t tapsCount, bool perChannel, float* output);
+// Same, with the output range split across the pool's workers (pool may be NULL)
+void firPoolBatch(FirPool* pool, const short* input, size_t channels, size_t outputCount,
+                  const float* taps, size_t tapsCount, bool perChannel, float* output);
+
+// Layout conversion between planar rows of samples values and the interleaved layout
+void firBatchInterleave(const short* planar, size_t channels, size_t samples, short* interleaved);
+void firBatchDeinterleave(const float* interleaved, size_t channels, size_t samples, float* planar);
+#endif // FIR_BATCH_H
@@ -0,0 +1,197 @@
+#include "fir_buffer.h"
+#include "fir_trace.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct FirClBuffer {
+    cl_context context;
+    cl_mem mem;
+    cl_mem_flags flags;  // access flags as requested
+    size_t size;
+    void* host;          // wrapped host memory, NULL for pooled buffers
+    bool inUse;
+    struct FirClBuffer* next;
+} FirClBuffer;
+
+static FirClBuffer* buffers = NULL;
+static pthread_mutex_t bufferLock = PTHREAD_MUTEX_INITIALIZER;
+
+bool firClZeroCopy(const FirClEnv* env) {
+    cl_bool unified = CL_FALSE;
+    cl_device_type type = 0;
+    clGetDeviceInfo(env->device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+    clGetDeviceInfo(env->device, CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+    return unified == CL_TRUE || (type & CL_DEVICE_TYPE_CPU) != 0;
+}
+
+void* firClHostAlloc(size_t size) {
+    size = (size + FIR_CL_HOST_ALIGN - 1) / FIR_CL_HOST_ALIGN * FIR_CL_HOST_ALIGN;
+#ifdef _WIN32
+    return _aligned_malloc(size, FIR_CL_HOST_ALIGN);
+#else
+    void* host = NULL;
+    return posix_memalign(&host, FIR_CL_HOST_ALIGN, size) == 0 ? host : NULL;
+#endif
+}
+
+void firClHostFree(void* host) {
+#ifdef _WIN32
+    _aligned_free(host);
+#else
+    free(host);
+#endif
+}
+
+cl_mem firClBufferAcquire(const FirClEnv* env, cl_mem_flags flags, size_t size, void* host, cl_int* status) {
+    const bool zeroCopy = firClZeroCopy(env);
+    // Only zero-copy devices gain from wrapping; elsewhere the host data is copied
+    if(!zeroCopy)
+        host = NULL;
+
+    pthread_mutex_lock(&bufferLock);
+    if(host == NULL){
+        // Smallest free pooled buffer that is large enough
+        FirClBuffer* best = NULL;
+        for(FirClBuffer* buffer = buffers; buffer != NULL; buffer = buffer->next){
+            if(!buffer->inUse && buffer->host == NULL && buffer->context == env->context && buffer->flags == flags
+               && buffer->size >= size && (best == NULL || buffer->size < best->size))
+                best = buffer;
+        }
+        if(best != NULL){
+            best->inUse = true;
+            pthread_mutex_unlock(&bufferLock);
+            *status = CL_SUCCESS;
+            return best->mem;
+        }
+    }
+
+    FirClBuffer* buffer = (FirClBuffer*)calloc(1, sizeof(FirClBuffer));
+    if(buffer == NULL){
+        pthread_mutex_unlock(&bufferLock);
+        *status = CL_OUT_OF_HOST_MEMORY;
+        return NULL;
+    }
+    cl_mem_flags createFlags = flags;
+    if(host != NULL)
+        createFlags |= CL_MEM_USE_HOST_PTR;
+    else if(zeroCopy)
+        createFlags |= CL_MEM_ALLOC_HOST_PTR;
+    buffer->mem = clCreateBuffer(env->context, createFlags, size, host, status);
+    if(*status != CL_SUCCESS){
+        free(buffer);
+        pthread_mutex_unlock(&bufferLock);
+        return NULL;
+    }
+    buffer->context = env->context;
+    buffer->flags = flags;
+    buffer->size = size;
+    buffer->host = host;
+    buffer->inUse = true;
+    buffer->next = buffers;
+    buffers = buffer;
+    pthread_mutex_unlock(&bufferLock);
+    return buffer->mem;
+}
+
+void firClBufferRelease(cl_mem mem) {
+    if(mem == NULL)
+        return;
+    pthread_mutex_lock(&bufferLock);
+    for(FirClBuffer** link = &buffers; *link != NULL; link = &(*link)->next){
+        FirClBuffer* buffer = *link;
+        if(buffer->mem != mem)
+            continue;
+        // Wrapped buffers are tied to memory the caller is about to free: never pool them
+        if(buffer->host != NULL){
+            *link = buffer->next;
+            clReleaseMemObject(buffer->mem);
+            free(buffer);
+        }
+        else{
+            buffer->inUse = false;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&bufferLock);
+}
+
+void firClReleaseBuffers() {
+    pthread_mutex_lock(&bufferLock);
+    while(buffers != NULL){
+        FirClBuffer* next = buffers->next;
+        clReleaseMemObject(buffers->mem);
+        free(buffers);
+        buffers = next;
+    }
+    pthread_mutex_unlock(&bufferLock);
+}
+
+void firClReleaseContextBuffers(cl_context context) {
+    pthread_mutex_lock(&bufferLock);
+    for(FirClBuffer** link = &buffers; *link != NULL;){
+        FirClBuffer* buffer = *link;
+        if(buffer->context != context){
+            link = &buffer->next;
+            continue;
+        }
+        *link = buffer->next;
+        clReleaseMemObject(buffer->mem);
+        free(buffer);
+    }
+    pthread_mutex_unlock(&bufferLock);
+}
+
+// Host-visible (CL_MEM_ALLOC_HOST_PTR) buffers are filled and drained through a map. Wrapped
+// buffers use read/write commands: mapping one with CL_MAP_WRITE_INVALIDATE_REGION leaves its
+// contents undefined, while a command from its own host_ptr is defined once the buffer is
+// idle and unmapped, and costs no copy on zero-copy drivers. Decided from the buffer's own
+// flags, so transfers never take bufferLock.
+static bool transfersByMap(cl_mem mem) {
+    cl_mem_flags flags = 0;
+    return clGetMemObjectInfo(mem, CL_MEM_FLAGS, sizeof(flags), &flags, NULL) == CL_SUCCESS
+        && (flags & CL_MEM_ALLOC_HOST_PTR) != 0;
+}
+
+cl_int firClBufferWrite(const FirClEnv* env, cl_mem mem, size_t size, const void* data, cl_event* event) {
+    cl_int status;
+    FirTraceCall trace;
+    if(!transfersByMap(mem)){
+        status = clEnqueueWriteBuffer(env->queue, mem, CL_TRUE, 0, size, data, 0, NULL, firTraceBegin(&trace, event));
+        firTraceEnd(&trace, event, FIR_TRACE_UPLOAD, "write", status, size, 0);
+        return status;
+    }
+    // Traced from the map to the finish, as the copy itself runs on the host
+    const uint64_t traceStart = firTraceStart();
+    void* mapped = clEnqueueMapBuffer(env->queue, mem, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, size, 0, NULL, event, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    memcpy(mapped, data, size);
+    status = clEnqueueUnmapMemObject(env->queue, mem, mapped, 0, NULL, NULL);
+    if(status == CL_SUCCESS)
+        status = clFinish(env->queue);
+    if(status == CL_SUCCESS)
+        firTraceHost(FIR_TRACE_UPLOAD, "map write", traceStart, size, 0);
+    return status;
+}
+
+cl_int firClBufferRead(const FirClEnv* env, cl_mem mem, size_t size, void* data, cl_event* event) {
+    cl_int status;
+    FirTraceCall trace;
+    if(!transfersByMap(mem)){
+        status = clEnqueueReadBuffer(env->queue, mem, CL_TRUE, 0, size, data, 0, NULL, firTraceBegin(&trace, event));
+        firTraceEnd(&trace, event, FIR_TRACE_READBACK, "read", status, size, 0);
+        return status;
+    }
+    const uint64_t traceStart = firTraceStart();
+    void* mapped = clEnqueueMapBuffer(env->queue, mem, CL_TRUE, CL_MAP_READ, 0, size, 0, NULL, event, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    memcpy(data, mapped, size);
+    status = clEnqueueUnmapMemObject(env->queue, mem, mapped, 0, NULL, NULL);
+    if(status == CL_SUCCESS)
+        status = clFinish(env->queue);
+    if(status == CL_SUCCESS)
+        firTraceHost(FIR_TRACE_READBACK, "map read", traceStart, size, 0);
+    return status;
+}
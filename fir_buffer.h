@@ -0,0 +1,37 @@
+#ifndef FIR_BUFFER_H
+#define FIR_BUFFER_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <CL/cl.h>
+#include "fir_cl.h"
+
+// Alignment of firClHostAlloc memory; page alignment lets drivers wrap it without a copy
+#define FIR_CL_HOST_ALIGN 4096
+
+// True when the device works on host memory directly (integrated GPUs, CPU devices):
+// buffers then live in host-visible memory and are accessed by mapping, not copying
+bool firClZeroCopy(const FirClEnv* env);
+
+void* firClHostAlloc(size_t size);
+void firClHostFree(void* host);
+
+// A buffer of at least size bytes with the given access flags. With host == NULL it comes
+// from a pool shared across calls (CL_MEM_ALLOC_HOST_PTR on zero-copy devices) and goes
+// back there on firClBufferRelease. A firClHostAlloc'd host is wrapped with
+// CL_MEM_USE_HOST_PTR on zero-copy devices; release such a buffer before freeing host.
+cl_mem firClBufferAcquire(const FirClEnv* env, cl_mem_flags flags, size_t size, void* host, cl_int* status);
+void firClBufferRelease(cl_mem mem);
+// Release every pooled buffer (none may be in use)
+void firClReleaseBuffers();
+// Only the pooled buffers of one context, before that context is released
+void firClReleaseContextBuffers(cl_context context);
+
+// Blocking transfers between data and the first size bytes of mem: map, copy and unmap for
+// CL_MEM_ALLOC_HOST_PTR buffers (pooled ones on zero-copy devices), read/write commands
+// otherwise (including buffers that wrap host memory, where the driver can skip the copy
+// when data is that memory). Any cl_mem works, registered here or not.
+// event (may be NULL) times the transfer command; on the map path only the map is a
+// command, the copy runs on the host.
+cl_int firClBufferWrite(const FirClEnv* env, cl_mem mem, size_t size, const void* data, cl_event* event);
+cl_int firClBufferRead(const FirClEnv* env, cl_mem mem, size_t size, void* data, cl_event* event);
+#endif // FIR_BUFFER_H
@@ -0,0 +1,176 @@
+#include "fir_cache.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define makeDir(path) _mkdir(path)
+#else
+#define makeDir(path) mkdir(path, 0755)
+#endif
+
+#define FIR_CACHE_MAGIC "FIRBIN1"
+
+static uint64_t fnv1a(uint64_t hash, const char* data, size_t size) {
+    for(size_t i = 0; i < size; i++){
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Full key text stored in the file (guards against hash collisions); returns malloc'd string
+static char* cacheKey(cl_device_id device, const char* source, const char* options) {
+    char name[256] = "", driver[256] = "";
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+    uint64_t sourceHash = fnv1a(14695981039346656037ULL, source, strlen(source));
+    size_t size = strlen(name) + strlen(driver) + strlen(options) + 64;
+    char* key = (char*)malloc(size);
+    if(key != NULL)
+        snprintf(key, size, "%s|%s|%016llx|%s", name, driver, (unsigned long long)sourceHash, options);
+    return key;
+}
+
+bool firClCacheDir(char* path, size_t size) {
+    const char* dir = getenv(FIR_CACHE_DIR_ENV);
+    if(dir != NULL && dir[0] != '\0'){
+        snprintf(path, size, "%s", dir);
+    }
+    else{
+#ifdef _WIN32
+        const char* base = getenv("LOCALAPPDATA");
+        if(base == NULL)
+            return false;
+        snprintf(path, size, "%s\\fir-filter", base);
+#else
+        const char* base = getenv("XDG_CACHE_HOME");
+        const char* home = getenv("HOME");
+        if(base != NULL && base[0] != '\0')
+            snprintf(path, size, "%s/fir-filter", base);
+        else if(home != NULL)
+            snprintf(path, size, "%s/.cache/fir-filter", home);
+        else
+            return false;
+#endif
+    }
+    makeDir(path);
+    return true;
+}
+
+static bool cachePath(const char* key, char* path, size_t size) {
+    char dir[960];
+    if(!firClCacheDir(dir, sizeof(dir)))
+        return false;
+    uint64_t hash = fnv1a(14695981039346656037ULL, key, strlen(key));
+    snprintf(path, size, "%s/%016llx.bin", dir, (unsigned long long)hash);
+    return true;
+}
+
+// Returns the cached binary for key (malloc'd) or NULL
+static unsigned char* loadBinary(const char* path, const char* key, size_t* binarySize) {
+    FILE* file = fopen(path, "rb");
+    if(file == NULL)
+        return NULL;
+    unsigned char* binary = NULL;
+    char magic[sizeof(FIR_CACHE_MAGIC)];
+    uint64_t keySize = 0, size = 0;
+    const size_t expectedKeySize = strlen(key);
+    if(fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, FIR_CACHE_MAGIC, sizeof(magic)) == 0
+       && fread(&keySize, sizeof(keySize), 1, file) == 1 && keySize == expectedKeySize){
+        char* storedKey = (char*)malloc(expectedKeySize);
+        if(storedKey != NULL && fread(storedKey, 1, expectedKeySize, file) == expectedKeySize
+           && memcmp(storedKey, key, expectedKeySize) == 0
+           && fread(&size, sizeof(size), 1, file) == 1 && size > 0){
+            binary = (unsigned char*)malloc((size_t)size);
+            if(binary != NULL && fread(binary, 1, (size_t)size, file) != size){
+                free(binary);
+                binary = NULL;
+            }
+            *binarySize = (size_t)size;
+        }
+        free(storedKey);
+    }
+    fclose(file);
+    return binary;
+}
+
+// Written to a temporary name first so a concurrent reader never sees half a file
+static void storeBinary(const char* path, const char* key, cl_program program) {
+    size_t size = 0;
+    if(clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) != CL_SUCCESS || size == 0)
+        return;
+    unsigned char* binary = (unsigned char*)malloc(size);
+    if(binary == NULL)
+        return;
+    if(clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL) == CL_SUCCESS){
+        char temp[1100];
+        snprintf(temp, sizeof(temp), "%s.tmp", path);
+        FILE* file = fopen(temp, "wb");
+        if(file != NULL){
+            uint64_t keySize = strlen(key), binarySize = size;
+            bool ok = fwrite(FIR_CACHE_MAGIC, 1, sizeof(FIR_CACHE_MAGIC), file) == sizeof(FIR_CACHE_MAGIC)
+                   && fwrite(&keySize, sizeof(keySize), 1, file) == 1
+                   && fwrite(key, 1, (size_t)keySize, file) == keySize
+                   && fwrite(&binarySize, sizeof(binarySize), 1, file) == 1
+                   && fwrite(binary, 1, size, file) == size;
+            ok = fclose(file) == 0 && ok;
+            remove(ok ? path : temp);
+            if(ok && rename(temp, path) != 0)
+                remove(temp);
+        }
+    }
+    free(binary);
+}
+
+static cl_program buildFromSource(cl_context context, cl_device_id device, const char* source,
+                                  const char* options, cl_int* status) {
+    size_t sourceSize = strlen(source);
+    cl_program program = clCreateProgramWithSource(context, 1, &source, &sourceSize, status);
+    if(*status != CL_SUCCESS)
+        return NULL;
+    *status = clBuildProgram(program, 1, &device, options, NULL, NULL);
+    return program;
+}
+
+cl_program firClBuildCached(cl_context context, cl_device_id device, const char* source,
+                            const char* options, bool* fromCache, cl_int* status) {
+    if(options == NULL)
+        options = "";
+    if(fromCache != NULL)
+        *fromCache = false;
+    char* key = cacheKey(device, source, options);
+    char path[1024];
+    const bool cached = key != NULL && cachePath(key, path, sizeof(path));
+
+    if(cached){
+        size_t binarySize = 0;
+        unsigned char* binary = loadBinary(path, key, &binarySize);
+        if(binary != NULL){
+            cl_int binaryStatus;
+            const unsigned char* binaries[1] = {binary};
+            cl_program program = clCreateProgramWithBinary(context, 1, &device, &binarySize, binaries, &binaryStatus, status);
+            if(*status == CL_SUCCESS && binaryStatus == CL_SUCCESS)
+                *status = clBuildProgram(program, 1, &device, options, NULL, NULL);
+            free(binary);
+            if(*status == CL_SUCCESS && binaryStatus == CL_SUCCESS){
+                free(key);
+                if(fromCache != NULL)
+                    *fromCache = true;
+                return program;
+            }
+            // Stale or foreign binary: drop it and fall back to source
+            if(program != NULL)
+                clReleaseProgram(program);
+            remove(path);
+        }
+    }
+
+    cl_program program = buildFromSource(context, device, source, options, status);
+    if(cached && *status == CL_SUCCESS)
+        storeBinary(path, key, program);
+    free(key);
+    return program;
+}
@@ -0,0 +1,19 @@
+#ifndef FIR_CACHE_H
+#define FIR_CACHE_H
+#include <stdbool.h>
+#include <CL/cl.h>
+
+// Directory for cached program binaries: $FIR_CL_CACHE_DIR, else the per-user cache
+// directory ($XDG_CACHE_HOME or ~/.cache, %LOCALAPPDATA% on Windows) + "/fir-filter"
+#define FIR_CACHE_DIR_ENV "FIR_CL_CACHE_DIR"
+
+// Writes that directory to path, creating it if needed; false when there is none
+bool firClCacheDir(char* path, size_t size);
+
+// Build source for device with options, going through an on-disk CL_PROGRAM_BINARIES
+// cache keyed by device name, driver version, source hash and options. A binary the
+// driver rejects is discarded and the program is rebuilt from source (and re-cached).
+// fromCache (may be NULL) reports whether the binary was reused.
+cl_program firClBuildCached(cl_context context, cl_device_id device, const char* source,
+                            const char* options, bool* fromCache, cl_int* status);
+#endif // FIR_CACHE_H
@@ -0,0 +1,238 @@
+#include "fir_chain.h"
+#include "cpu_simd.h"
+#include "fir_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Outputs per vector in the float stages
+#define FIR_CHAIN_LANES 8
+
+typedef float FirChainLanes __attribute__((vector_size(FIR_CHAIN_LANES * sizeof(float))));
+
+struct FirChain {
+    size_t stages;
+    size_t* tapsCounts;
+    float* taps;          // every stage's taps back to back
+    size_t tapsTotal;
+    size_t halo;
+    size_t blockSize;     // final outputs per block
+    // Two ping-pong buffers of blockSize + halo floats per worker
+    float* scratch;
+    size_t scratchWorkers;
+};
+
+FirChain* firChainCreate(const float* const* taps, const size_t* tapsCounts, size_t stages) {
+    if(stages == 0)
+        return NULL;
+    FirChain* chain = (FirChain*)calloc(1, sizeof(FirChain));
+    if(chain == NULL)
+        return NULL;
+    chain->stages = stages;
+    for(size_t s = 0; s < stages; s++){
+        if(tapsCounts[s] == 0){
+            free(chain);
+            return NULL;
+        }
+        chain->tapsTotal += tapsCounts[s];
+        chain->halo += tapsCounts[s] - 1;
+    }
+    chain->tapsCounts = (size_t*)malloc(sizeof(size_t) * stages);
+    chain->taps = (float*)malloc(sizeof(float) * chain->tapsTotal);
+    if(chain->tapsCounts == NULL || chain->taps == NULL){
+        firChainDestroy(chain);
+        return NULL;
+    }
+    float* at = chain->taps;
+    for(size_t s = 0; s < stages; s++){
+        chain->tapsCounts[s] = tapsCounts[s];
+        memcpy(at, taps[s], sizeof(float) * tapsCounts[s]);
+        at += tapsCounts[s];
+    }
+    // A block's two intermediate buffers stay around FIR_POOL_BLOCK_BYTES, like firPoolFilter's blocks
+    const size_t floats = FIR_POOL_BLOCK_BYTES / (2 * sizeof(float));
+    chain->blockSize = floats > chain->halo + 64 ? floats - chain->halo : 64;
+    chain->blockSize = (chain->blockSize + 63) & ~(size_t)63;
+    return chain;
+}
+
+void firChainDestroy(FirChain* chain) {
+    if(chain == NULL)
+        return;
+    free(chain->tapsCounts);
+    free(chain->taps);
+    free(chain->scratch);
+    free(chain);
+}
+
+size_t firChainHalo(const FirChain* chain) {
+    return chain->halo;
+}
+
+// output[i] = sum(input[i+j] * taps[j]) on float input, FIR_CHAIN_LANES outputs at a time
+static inline __attribute__((always_inline))
+void stageBody(const float* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) {
+    const size_t vectorOutputs = outputCount - outputCount % FIR_CHAIN_LANES;
+    for(size_t i = 0; i < vectorOutputs; i += FIR_CHAIN_LANES){
+        FirChainLanes acc = {0};
+        for(size_t j = 0; j < tapsCount; j++){
+            FirChainLanes x;
+            memcpy(&x, input + i + j, sizeof(x));
+            acc += x * taps[j];
+        }
+        memcpy(output + i, &acc, sizeof(acc));
+    }
+    for(size_t i = vectorOutputs; i < outputCount; i++){
+        float sum = 0;
+        for(size_t j = 0; j < tapsCount; j++)
+            sum += input[i + j] * taps[j];
+        output[i] = sum;
+    }
+}
+
+static void stageGeneric(const float* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) {
+    stageBody(input, outputCount, taps, tapsCount, output);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+static void stageAvx2(const float* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) {
+    stageBody(input, outputCount, taps, tapsCount, output);
+}
+#endif
+
+static void stage(const float* input, size_t outputCount, const float* taps, size_t tapsCount, float* output) {
+#if defined(__x86_64__) || defined(__i386__)
+    if(firSimdIsa() >= FIR_ISA_AVX2){
+        stageAvx2(input, outputCount, taps, tapsCount, output);
+        return;
+    }
+#endif
+    stageGeneric(input, outputCount, taps, tapsCount, output);
+}
+
+// Final outputs [first, first + count) through every stage in the worker's scratch
+static void filterBlock(const FirChain* chain, const short* input, size_t first, size_t count,
+                        float* output, unsigned worker) {
+    float* src = chain->scratch + (size_t)worker * 2 * (chain->blockSize + chain->halo);
+    float* dst = src + chain->blockSize + chain->halo;
+    size_t remaining = count + chain->halo;
+    const float* taps = chain->taps;
+    for(size_t s = 0; s < chain->stages; s++){
+        const size_t tapsCount = chain->tapsCounts[s];
+        remaining -= tapsCount - 1;
+        float* out = s + 1 < chain->stages ? dst : output + first;
+        if(s == 0)
+            firSimd(input + first, remaining, taps, tapsCount, out);
+        else
+            stage(src, remaining, taps, tapsCount, out);
+        float* swap = src;
+        src = dst;
+        dst = swap;
+        taps += tapsCount;
+    }
+}
+
+typedef struct {
+    const FirChain* chain;
+    const short* input;
+    float* output;
+    size_t outputCount;
+} ChainJob;
+
+static void chainBlock(void* ctx, size_t task, unsigned worker) {
+    const ChainJob* job = (const ChainJob*)ctx;
+    const size_t first = task * job->chain->blockSize;
+    size_t count = job->outputCount - first;
+    if(count > job->chain->blockSize)
+        count = job->chain->blockSize;
+    filterBlock(job->chain, job->input, first, count, job->output, worker);
+}
+
+cl_int firChainFilter(FirChain* chain, FirPool* pool, const short* input, size_t outputCount, float* output) {
+    const size_t workers = pool ? firPoolThreads(pool) : 1;
+    if(workers > chain->scratchWorkers){
+        float* scratch = (float*)realloc(chain->scratch, workers * 2 * (chain->blockSize + chain->halo) * sizeof(float));
+        if(scratch == NULL)
+            return CL_OUT_OF_HOST_MEMORY;
+        chain->scratch = scratch;
+        chain->scratchWorkers = workers;
+    }
+    const uint64_t traceStart = firTraceStart();
+    ChainJob job = { chain, input, output, outputCount };
+    const size_t blocks = (outputCount + chain->blockSize - 1) / chain->blockSize;
+    if(pool == NULL || blocks <= 1){
+        for(size_t task = 0; task < blocks; task++)
+            chainBlock(&job, task, 0);
+    }
+    else{
+        firPoolRun(pool, blocks, chainBlock, &job);
+    }
+    firTraceCpu("firChainFilter", traceStart, outputCount);
+    return CL_SUCCESS;
+}
+
+cl_int firClChainCreate(const FirClEnv* env, const FirChain* chain, FirClChain* clChain) {
+    cl_int status;
+    memset(clChain, 0, sizeof(*clChain));
+    clChain->perGroup = FIR_CL_LOCAL_SIZE * FIR_CL_OUTPUTS_PER_ITEM;
+    cl_ulong local_mem_size = 0;
+    clGetDeviceInfo(env->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem_size), &local_mem_size, NULL);
+    if(2 * (clChain->perGroup + chain->halo) * sizeof(cl_float) > local_mem_size)
+        return CL_OUT_OF_RESOURCES;
+
+    // The tap counts become the kernel's compile-time stage table
+    const size_t optionsSize = 32 + chain->stages * 12;
+    char* options = (char*)malloc(optionsSize);
+    if(options == NULL)
+        return CL_OUT_OF_HOST_MEMORY;
+    int length = snprintf(options, optionsSize, "-D FIR_CHAIN_TAPS=");
+    for(size_t s = 0; s < chain->stages; s++)
+        length += snprintf(options + length, optionsSize - length, s ? ",%u" : "%u", (unsigned)chain->tapsCounts[s]);
+    cl_program program = firClVariantProgram(env, options, &status);
+    free(options);
+    if(program == NULL)
+        return status;
+    clChain->kernel = clCreateKernel(program, "FirFilterChain", &status);
+    if(status != CL_SUCCESS)
+        return status;
+    clChain->taps = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                   chain->tapsTotal * sizeof(cl_float), chain->taps, &status);
+    if(status != CL_SUCCESS)
+        firClChainRelease(clChain);
+    return status;
+}
+
+void firClChainRelease(FirClChain* clChain) {
+    if(clChain->kernel)
+        clReleaseKernel(clChain->kernel);
+    if(clChain->taps)
+        clReleaseMemObject(clChain->taps);
+    clChain->kernel = NULL;
+    clChain->taps = NULL;
+}
+
+cl_int firClEnqueueChain(const FirClEnv* env, const FirChain* chain, const FirClChain* clChain,
+                         cl_mem input, cl_mem output, cl_uint outputCount, cl_event* event) {
+    cl_int status;
+    cl_kernel kernel = clChain->kernel;
+    const cl_uint perGroup = (cl_uint)clChain->perGroup;
+    const size_t tileSize = (clChain->perGroup + chain->halo) * sizeof(cl_float);
+    status  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+    status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
+    status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &clChain->taps);
+    status |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &outputCount);
+    status |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &perGroup);
+    status |= clSetKernelArg(kernel, 5, tileSize, NULL);
+    status |= clSetKernelArg(kernel, 6, tileSize, NULL);
+    if(status != CL_SUCCESS || outputCount == 0)
+        return status;
+    const size_t groups = ((size_t)outputCount + perGroup - 1) / perGroup;
+    size_t local_work_size[1] = {FIR_CL_LOCAL_SIZE};
+    size_t global_work_size[1] = {groups * FIR_CL_LOCAL_SIZE};
+    FirTraceCall trace;
+    status = clEnqueueNDRangeKernel(env->queue, kernel, 1, NULL, global_work_size, local_work_size, 0, NULL,
+                                    firTraceBegin(&trace, event));
+    firTraceEnd(&trace, event, FIR_TRACE_KERNEL, "FirFilterChain", status, 0, outputCount);
+    return status;
+}
@@ -0,0 +1,36 @@
+#ifndef FIR_CHAIN_H
+#define FIR_CHAIN_H
+#include <stddef.h>
+#include "cpu_pool.h"
+#include "fir_cl.h"
+
+// Cascade of FIR stages run as one filter: stage 0 filters the int16 input, every later
+// stage the float output of the one before. outputCount final outputs need
+// outputCount + firChainHalo() input samples, the halo being the sum of tapsCount-1 over
+// the stages. Intermediate results never leave cache (CPU) or local memory (OpenCL), so a
+// chain moves about as many bytes as a single stage.
+typedef struct FirChain FirChain;
+
+// Stage s has tapsCounts[s] taps at taps[s]; the taps are copied
+FirChain* firChainCreate(const float* const* taps, const size_t* tapsCounts, size_t stages);
+void firChainDestroy(FirChain* chain);
+size_t firChainHalo(const FirChain* chain);
+// Filter block by block, blocks spread over the pool when given (may be NULL).
+// One call per chain at a time: the chain owns the per-worker scratch, grown here to the
+// pool's worker count; CL_OUT_OF_HOST_MEMORY, with output untouched, when that fails.
+cl_int firChainFilter(FirChain* chain, FirPool* pool, const short* input, size_t outputCount, float* output);
+
+// FirFilterChain built for this chain's tap counts (-D FIR_CHAIN_TAPS, see firClVariantProgram),
+// with all stages' taps in one constant buffer
+typedef struct {
+    cl_kernel kernel;
+    cl_mem taps;
+    size_t perGroup;    // final outputs per work-group
+} FirClChain;
+
+// Needs env->source; CL_OUT_OF_RESOURCES when the two tiles do not fit local memory
+cl_int firClChainCreate(const FirClEnv* env, const FirChain* chain, FirClChain* clChain);
+void firClChainRelease(FirClChain* clChain);
+cl_int firClEnqueueChain(const FirClEnv* env, const FirChain* chain, const FirClChain* clChain,
+                         cl_mem input, cl_mem output, cl_uint outputCount, cl_event* event);
+#endif // FIR_CHAIN_H
@@ -0,0 +1,228 @@
+#include "fir_cl.h"
+#include "fir_cache.h"
+#include "fir_trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct FirClVariant {
+    cl_context context;
+    cl_device_id device;
+    char* options;
+    cl_program program;
+    struct FirClVariant* next;
+} FirClVariant;
+
+static FirClVariant* variants = NULL;
+static pthread_mutex_t variantLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void printBuildLog(cl_program program, cl_device_id device) {
+    size_t size = 0;
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &size);
+    char* log = (char*)malloc(size + 1);
+    if(log == NULL)
+        return;
+    clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, size, log, NULL);
+    log[size] = '\0';
+    printf("Build log:\n%s\n", log);
+    free(log);
+}
+
+static cl_program buildVariant(const FirClEnv* env, const char* options, cl_int* status) {
+    cl_program program = firClBuildCached(env->context, env->device, env->source, options, NULL, status);
+    if(program == NULL)
+        return NULL;
+    if(*status != CL_SUCCESS){
+        printf("Failed to build kernel variant \"%s\" (Error = %d)\n", options, *status);
+        printBuildLog(program, env->device);
+        clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+cl_program firClVariantProgram(const FirClEnv* env, const char* options, cl_int* status) {
+    // No defines: that is the program init() already built
+    if(options[0] == '\0' && env->program != NULL){
+        *status = CL_SUCCESS;
+        return env->program;
+    }
+    if(env->source == NULL){
+        *status = CL_INVALID_VALUE;
+        return NULL;
+    }
+    // Holding the lock across the build keeps two threads from compiling the same variant
+    pthread_mutex_lock(&variantLock);
+    for(FirClVariant* variant = variants; variant != NULL; variant = variant->next){
+        if(variant->context == env->context && variant->device == env->device && strcmp(variant->options, options) == 0){
+            pthread_mutex_unlock(&variantLock);
+            *status = CL_SUCCESS;
+            return variant->program;
+        }
+    }
+    cl_program program = buildVariant(env, options, status);
+    if(program != NULL){
+        FirClVariant* variant = (FirClVariant*)calloc(1, sizeof(FirClVariant));
+        char* copy = (char*)malloc(strlen(options) + 1);
+        if(variant == NULL || copy == NULL){
+            free(variant);
+            free(copy);
+            clReleaseProgram(program);
+            pthread_mutex_unlock(&variantLock);
+            *status = CL_OUT_OF_HOST_MEMORY;
+            return NULL;
+        }
+        strcpy(copy, options);
+        variant->context = env->context;
+        variant->device = env->device;
+        variant->options = copy;
+        variant->program = program;
+        variant->next = variants;
+        variants = variant;
+    }
+    pthread_mutex_unlock(&variantLock);
+    return program;
+}
+
+void firClReleaseVariants() {
+    pthread_mutex_lock(&variantLock);
+    while(variants != NULL){
+        FirClVariant* next = variants->next;
+        clReleaseProgram(variants->program);
+        free(variants->options);
+        free(variants);
+        variants = next;
+    }
+    pthread_mutex_unlock(&variantLock);
+}
+
+void firClReleaseContextVariants(cl_context context) {
+    pthread_mutex_lock(&variantLock);
+    FirClVariant** link = &variants;
+    while(*link != NULL){
+        FirClVariant* variant = *link;
+        if(variant->context != context){
+            link = &variant->next;
+            continue;
+        }
+        *link = variant->next;
+        clReleaseProgram(variant->program);
+        free(variant->options);
+        free(variant);
+    }
+    pthread_mutex_unlock(&variantLock);
+}
+
+size_t firClMaxTiledTaps(const FirClEnv* env, cl_uint outputsPerItem) {
+    return firClMaxTiledTapsSized(env, outputsPerItem, FIR_CL_LOCAL_SIZE);
+}
+
+size_t firClMaxTiledTapsSized(const FirClEnv* env, cl_uint outputsPerItem, size_t localSize) {
+    if(outputsPerItem == 0)
+        outputsPerItem = FIR_CL_OUTPUTS_PER_ITEM;
+    if(localSize == 0)
+        localSize = FIR_CL_LOCAL_SIZE;
+    cl_ulong local_mem_size = 0;
+    clGetDeviceInfo(env->device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_mem_size), &local_mem_size, NULL);
+    const size_t tileOutputs = localSize * outputsPerItem;
+    const size_t tileFloats = (size_t)(local_mem_size / sizeof(cl_float));
+    return tileFloats > tileOutputs ? tileFloats - tileOutputs + 1 : 0;
+}
+
+cl_int firClCreateFilter(const FirClEnv* env, size_t tapsCount, FirInputType type,
+                         cl_uint outputsPerItem, FirClFilter* filter) {
+    return firClCreateFilterSized(env, tapsCount, type, outputsPerItem, 0, filter);
+}
+
+cl_int firClCreateFilterSized(const FirClEnv* env, size_t tapsCount, FirInputType type,
+                              cl_uint outputsPerItem, size_t localSize, FirClFilter* filter) {
+    cl_int status;
+    if(outputsPerItem == 0)
+        outputsPerItem = FIR_CL_OUTPUTS_PER_ITEM;
+    filter->kernel = NULL;
+    filter->outputsPerItem = 0;
+    filter->localSize = localSize;
+    filter->tapsCount = 0;
+    if(tapsCount > firClMaxTiledTapsSized(env, outputsPerItem, localSize)){
+        if(type != FIR_INPUT_INT16)
+            return CL_INVALID_VALUE;
+        filter->kernel = clCreateKernel(env->program, "FirFilter", &status);
+        return status;
+    }
+
+    char options[128] = "";
+    int length = 0;
+    if(tapsCount <= FIR_CL_UNROLL_MAX_TAPS)
+        length += snprintf(options + length, sizeof(options) - length, "-D FIR_TAPS=%u ", (unsigned)tapsCount);
+    if(type == FIR_INPUT_FLOAT)
+        length += snprintf(options + length, sizeof(options) - length, "-D FIR_INPUT_T=float ");
+    if(outputsPerItem != FIR_CL_OUTPUTS_PER_ITEM)
+        snprintf(options + length, sizeof(options) - length, "-D FIR_OUTPUTS_PER_ITEM=%u", outputsPerItem);
+    cl_program program = firClVariantProgram(env, options, &status);
+    if(program == NULL && env->source == NULL && type == FIR_INPUT_INT16){
+        // No source to specialize from: the generic tiled kernel in env->program
+        program = env->program;
+        outputsPerItem = FIR_CL_OUTPUTS_PER_ITEM;
+    }
+    if(program == NULL)
+        return status;
+    filter->kernel = clCreateKernel(program, "FirFilterTiled", &status);
+    filter->outputsPerItem = outputsPerItem;
+    if(program != env->program && tapsCount <= FIR_CL_UNROLL_MAX_TAPS)
+        filter->tapsCount = (cl_uint)tapsCount;
+    return status;
+}
+
+cl_int firClCreateFilterQ15(const FirClEnv* env, FirClFilter* filter) {
+    cl_int status;
+    filter->kernel = clCreateKernel(env->program, "FirFilterQ15", &status);
+    filter->outputsPerItem = 0;
+    filter->localSize = 0;
+    filter->tapsCount = 0;
+    return status;
+}
+
+void firClReleaseFilter(FirClFilter* filter) {
+    if(filter->kernel)
+        clReleaseKernel(filter->kernel);
+    filter->kernel = NULL;
+}
+
+cl_int firClEnqueueFilter(const FirClEnv* env, const FirClFilter* filter, cl_mem input, cl_mem output, cl_mem taps,
+                          cl_uint tapsCount, cl_uint outputCount, cl_event* event) {
+    cl_int status;
+    cl_kernel kernel = filter->kernel;
+    // A -D FIR_TAPS kernel ignores tapsCount, and the tile below is sized from it
+    if(filter->tapsCount != 0 && filter->tapsCount != tapsCount)
+        return CL_INVALID_VALUE;
+    status  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+    status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
+    status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &taps);
+    status |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &tapsCount);
+    status |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &outputCount);
+    const size_t localSize = filter->localSize ? filter->localSize : FIR_CL_LOCAL_SIZE;
+    const size_t perGroup = localSize * (filter->outputsPerItem ? filter->outputsPerItem : 1);
+    if(filter->outputsPerItem)
+        status |= clSetKernelArg(kernel, 5, (perGroup + tapsCount - 1) * sizeof(cl_float), NULL);
+    if(status != CL_SUCCESS)
+        return status;
+    const size_t groups = ((size_t)outputCount + perGroup - 1) / perGroup;
+    size_t local_work_size[1] = {localSize};
+    size_t global_work_size[1] = {groups * localSize};
+    if(groups == 0)
+        return CL_SUCCESS;
+    FirTraceCall trace;
+    status = clEnqueueNDRangeKernel(env->queue, kernel, 1, NULL, global_work_size, local_work_size, 0, NULL,
+                                    firTraceBegin(&trace, event));
+    firTraceEnd(&trace, event, FIR_TRACE_KERNEL, "FirFilter", status, 0, outputCount);
+    return status;
+}
+
+double firClBytesPerOutput(const FirClFilter* filter, size_t tapsCount) {
+    if(filter->outputsPerItem){
+        const size_t perGroup = (filter->localSize ? filter->localSize : FIR_CL_LOCAL_SIZE) * filter->outputsPerItem;
+        return (double)(perGroup + tapsCount - 1) * sizeof(cl_short) / perGroup + sizeof(cl_float);
+    }
+    return (double)tapsCount * sizeof(cl_short) + sizeof(cl_float);
+}
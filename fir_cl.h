@@ -0,0 +1,66 @@
+#ifndef FIR_CL_H
+#define FIR_CL_H
+#include <stddef.h>
+#include <CL/cl.h>
+
+// Work-items per group and default outputs per work-item of FirFilterTiled
+#define FIR_CL_LOCAL_SIZE 64
+#define FIR_CL_OUTPUTS_PER_ITEM 4
+// Tap counts up to this are compiled in (-D FIR_TAPS) so the tap loop unrolls
+#define FIR_CL_UNROLL_MAX_TAPS 256
+
+// OpenCL objects a filter needs; the engines borrow them and never release them.
+// source is the kernel.cl text, needed to build specialized variants (may be NULL).
+typedef struct {
+    cl_context context;
+    cl_device_id device;
+    cl_command_queue queue;
+    cl_program program;
+    const char* source;
+} FirClEnv;
+
+typedef enum {
+    FIR_INPUT_INT16 = 0,
+    FIR_INPUT_FLOAT
+} FirInputType;
+
+// A direct-convolution kernel plus how it maps outputs to work-items
+typedef struct {
+    cl_kernel kernel;
+    cl_uint outputsPerItem;  // 0 for the untiled FirFilter (one output per work-item)
+    size_t localSize;        // work-items per group, 0 = FIR_CL_LOCAL_SIZE
+    cl_uint tapsCount;       // tap count compiled in (-D FIR_TAPS), 0 = any
+} FirClFilter;
+
+// kernel.cl built with the given -D options, built on first use and cached per
+// context/device/options until firClReleaseVariants. Safe to call from several threads.
+cl_program firClVariantProgram(const FirClEnv* env, const char* options, cl_int* status);
+void firClReleaseVariants();
+// Only the variants of one context, before that context is released
+void firClReleaseContextVariants(cl_context context);
+
+// FirFilterTiled specialized for tapsCount/type/outputsPerItem (0 = default) when its
+// tile fits the device's local memory, the untiled FirFilter otherwise
+cl_int firClCreateFilter(const FirClEnv* env, size_t tapsCount, FirInputType type,
+                         cl_uint outputsPerItem, FirClFilter* filter);
+// Same with localSize work-items per group (0 = FIR_CL_LOCAL_SIZE); the tile then
+// holds localSize*outputsPerItem + tapsCount - 1 floats
+cl_int firClCreateFilterSized(const FirClEnv* env, size_t tapsCount, FirInputType type,
+                              cl_uint outputsPerItem, size_t localSize, FirClFilter* filter);
+// Q15 FirFilterQ15 (int16 taps and outputs, see firSimdQ15); enqueued like the untiled
+// filter with taps and output buffers of cl_short
+cl_int firClCreateFilterQ15(const FirClEnv* env, FirClFilter* filter);
+void firClReleaseFilter(FirClFilter* filter);
+// Largest tap count whose tile still fits in local memory
+size_t firClMaxTiledTaps(const FirClEnv* env, cl_uint outputsPerItem);
+size_t firClMaxTiledTapsSized(const FirClEnv* env, cl_uint outputsPerItem, size_t localSize);
+
+// Set the filter arguments and enqueue enough work-items for outputCount outputs.
+// input must hold outputCount + tapsCount - 1 samples. CL_INVALID_VALUE when the filter
+// was built for a different tap count.
+cl_int firClEnqueueFilter(const FirClEnv* env, const FirClFilter* filter, cl_mem input, cl_mem output, cl_mem taps,
+                          cl_uint tapsCount, cl_uint outputCount, cl_event* event);
+
+// Global-memory bytes moved per output (int16 input reads + output write), ignoring caches
+double firClBytesPerOutput(const FirClFilter* filter, size_t tapsCount);
+#endif // FIR_CL_H
@@ -0,0 +1,610 @@
+#include "fir_fft.h"
+#include "cpu_simd.h"
+#include "fir_trace.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Smallest FFT used, and how many taps' worth of samples a segment spans
+#define FIR_FFT_MIN_SIZE 1024
+#define FIR_FFT_SIZE_PER_TAP 4
+// Segments transformed side by side, one per vector lane
+#define FIR_FFT_LANES 8
+
+typedef float FirLanes __attribute__((vector_size(FIR_FFT_LANES * sizeof(float))));
+
+typedef struct {
+    float re;
+    float im;
+} FirComplex;
+
+struct FirFftPlan {
+    size_t tapsCount;
+    size_t fftSize;
+    size_t hop;
+    float* twiddleRe;      // exp(-2*pi*i*m/fftSize), m < fftSize
+    float* twiddleIm;
+    FirComplex* spectrum;  // FFT of the reversed taps
+    // Split real/imaginary work arrays, each fftSize vectors of FIR_FFT_LANES segments
+    FirLanes* re[2];
+    FirLanes* im[2];
+    void* memory;
+    void (*batch)(const FirFftPlan*, const short*, size_t, size_t, size_t, float*);
+};
+
+static size_t fftSizeFor(size_t tapsCount) {
+    size_t size = FIR_FFT_MIN_SIZE;
+    while(size < FIR_FFT_SIZE_PER_TAP * tapsCount)
+        size *= 2;
+    return size;
+}
+
+// Stockham autosort FFT (radix-4 passes plus one radix-2 pass for odd powers of two),
+// run on every lane at once. Ping-pongs between the two work arrays; returns the one
+// holding the natural-order result.
+static inline __attribute__((always_inline))
+int fftLanes(const FirFftPlan* plan, int from) {
+    const size_t n = plan->fftSize;
+    const float* wr = plan->twiddleRe;
+    const float* wi = plan->twiddleIm;
+    size_t p = 1;
+    if(__builtin_ctzl(n) & 1){
+        const FirLanes* sr = plan->re[from];
+        const FirLanes* si = plan->im[from];
+        FirLanes* dr = plan->re[!from];
+        FirLanes* di = plan->im[!from];
+        const size_t half = n / 2;
+        for(size_t i = 0; i < half; i++){
+            const FirLanes ar = sr[i], ai = si[i], br = sr[i + half], bi = si[i + half];
+            dr[2*i] = ar + br;
+            di[2*i] = ai + bi;
+            dr[2*i + 1] = ar - br;
+            di[2*i + 1] = ai - bi;
+        }
+        from = !from;
+        p = 2;
+    }
+    const size_t quarter = n / 4;
+    for(; p < n; p *= 4){
+        const FirLanes* sr = plan->re[from];
+        const FirLanes* si = plan->im[from];
+        FirLanes* dr = plan->re[!from];
+        FirLanes* di = plan->im[!from];
+        const size_t stride = quarter / p;
+        for(size_t i = 0; i < quarter; i++){
+            const size_t k = i & (p - 1);
+            const size_t j = ((i - k) << 2) + k;
+            const size_t t = k * stride;
+            const float w1r = wr[t], w1i = wi[t];
+            const float w2r = wr[2*t], w2i = wi[2*t];
+            const float w3r = wr[3*t], w3i = wi[3*t];
+            const FirLanes x0r = sr[i], x0i = si[i];
+            FirLanes ar = sr[i + quarter], ai = si[i + quarter];
+            const FirLanes x1r = ar*w1r - ai*w1i, x1i = ar*w1i + ai*w1r;
+            ar = sr[i + 2*quarter];
+            ai = si[i + 2*quarter];
+            const FirLanes x2r = ar*w2r - ai*w2i, x2i = ar*w2i + ai*w2r;
+            ar = sr[i + 3*quarter];
+            ai = si[i + 3*quarter];
+            const FirLanes x3r = ar*w3r - ai*w3i, x3i = ar*w3i + ai*w3r;
+            const FirLanes s02r = x0r + x2r, s02i = x0i + x2i;
+            const FirLanes d02r = x0r - x2r, d02i = x0i - x2i;
+            const FirLanes s13r = x1r + x3r, s13i = x1i + x3i;
+            const FirLanes d13r = x1r - x3r, d13i = x1i - x3i;
+            dr[j] = s02r + s13r;
+            di[j] = s02i + s13i;
+            dr[j + p] = d02r + d13i;
+            di[j + p] = d02i - d13r;
+            dr[j + 2*p] = s02r - s13r;
+            di[j + 2*p] = s02i - s13i;
+            dr[j + 3*p] = d02r - d13i;
+            di[j + 3*p] = d02i + d13r;
+        }
+        from = !from;
+    }
+    return from;
+}
+
+// One batch covers 2*FIR_FFT_LANES consecutive segments starting at output first.
+// Segments are real, so lane l carries segment l in the real part and segment
+// FIR_FFT_LANES+l in the imaginary part; the taps are real too, so after the inverse
+// transform each comes back in its own part.
+static inline __attribute__((always_inline))
+void batchBody(const FirFftPlan* plan, const short* input, size_t inputCount,
+               size_t first, size_t outputCount, float* output) {
+    const size_t fftSize = plan->fftSize;
+    const size_t hop = plan->hop;
+    const size_t history = plan->tapsCount - 1;
+    const float scale = 1.0f / (float)fftSize;
+    FirLanes* re = plan->re[0];
+    FirLanes* im = plan->im[0];
+
+    if(first + (2*FIR_FFT_LANES - 1)*hop + fftSize <= inputCount){
+        for(size_t k = 0; k < fftSize; k++){
+            const short* x = input + first + k;
+            for(size_t l = 0; l < FIR_FFT_LANES; l++){
+                re[k][l] = x[l*hop];
+                im[k][l] = x[(FIR_FFT_LANES + l)*hop];
+            }
+        }
+    }
+    else{
+        // Last batch: segments run past the input and are zero padded
+        for(size_t k = 0; k < fftSize; k++){
+            for(size_t l = 0; l < FIR_FFT_LANES; l++){
+                const size_t a = first + l*hop + k;
+                const size_t b = first + (FIR_FFT_LANES + l)*hop + k;
+                re[k][l] = a < inputCount ? input[a] : 0;
+                im[k][l] = b < inputCount ? input[b] : 0;
+            }
+        }
+    }
+    int at = fftLanes(plan, 0);
+    // Multiply by the taps, conjugating so a second forward FFT performs the inverse
+    re = plan->re[at];
+    im = plan->im[at];
+    for(size_t k = 0; k < fftSize; k++){
+        const float hr = plan->spectrum[k].re, hi = plan->spectrum[k].im;
+        const FirLanes a = re[k], b = im[k];
+        re[k] = a*hr - b*hi;
+        im[k] = -(a*hi + b*hr);
+    }
+    at = fftLanes(plan, at);
+    re = plan->re[at];
+    im = plan->im[at];
+    for(size_t l = 0; l < FIR_FFT_LANES; l++){
+        const size_t a = first + l*hop;
+        const size_t b = first + (FIR_FFT_LANES + l)*hop;
+        for(size_t k = 0; k < hop && a + k < outputCount; k++){
+            output[a + k] = re[k + history][l] * scale;
+        }
+        for(size_t k = 0; k < hop && b + k < outputCount; k++){
+            output[b + k] = -im[k + history][l] * scale;
+        }
+    }
+}
+
+static void batchGeneric(const FirFftPlan* plan, const short* input, size_t inputCount,
+                         size_t first, size_t outputCount, float* output) {
+    batchBody(plan, input, inputCount, first, outputCount, output);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+static void batchAvx2(const FirFftPlan* plan, const short* input, size_t inputCount,
+                      size_t first, size_t outputCount, float* output) {
+    batchBody(plan, input, inputCount, first, outputCount, output);
+}
+#endif
+
+FirFftPlan* firFftCreate(const float* taps, size_t tapsCount) {
+    if(tapsCount == 0)
+        return NULL;
+    FirFftPlan* plan = (FirFftPlan*)calloc(1, sizeof(FirFftPlan));
+    if(plan == NULL)
+        return NULL;
+    plan->tapsCount = tapsCount;
+    plan->fftSize = fftSizeFor(tapsCount);
+    plan->hop = plan->fftSize - tapsCount + 1;
+    const size_t n = plan->fftSize;
+    plan->twiddleRe = (float*)malloc(sizeof(float) * n);
+    plan->twiddleIm = (float*)malloc(sizeof(float) * n);
+    plan->spectrum = (FirComplex*)malloc(sizeof(FirComplex) * n);
+    plan->memory = malloc(4 * n * sizeof(FirLanes) + 64);
+    if(plan->twiddleRe == NULL || plan->twiddleIm == NULL || plan->spectrum == NULL || plan->memory == NULL){
+        firFftDestroy(plan);
+        return NULL;
+    }
+    FirLanes* lanes = (FirLanes*)(((size_t)plan->memory + 63) & ~(size_t)63);
+    plan->re[0] = lanes;
+    plan->im[0] = lanes + n;
+    plan->re[1] = lanes + 2*n;
+    plan->im[1] = lanes + 3*n;
+    for(size_t m = 0; m < n; m++){
+        double angle = -2.0 * M_PI * (double)m / (double)n;
+        plan->twiddleRe[m] = (float)cos(angle);
+        plan->twiddleIm[m] = (float)sin(angle);
+    }
+    plan->batch = batchGeneric;
+#if defined(__x86_64__) || defined(__i386__)
+    if(firSimdIsa() >= FIR_ISA_AVX2)
+        plan->batch = batchAvx2;
+#endif
+
+    // output[i] = sum(input[i+j]*taps[j]) is a convolution with the reversed taps
+    memset(plan->re[0], 0, n * sizeof(FirLanes));
+    memset(plan->im[0], 0, n * sizeof(FirLanes));
+    for(size_t j = 0; j < tapsCount; j++){
+        plan->re[0][j][0] = taps[tapsCount - 1 - j];
+    }
+    int at = fftLanes(plan, 0);
+    for(size_t k = 0; k < n; k++){
+        plan->spectrum[k].re = plan->re[at][k][0];
+        plan->spectrum[k].im = plan->im[at][k][0];
+    }
+    return plan;
+}
+
+void firFftDestroy(FirFftPlan* plan) {
+    if(plan == NULL)
+        return;
+    free(plan->twiddleRe);
+    free(plan->twiddleIm);
+    free(plan->spectrum);
+    free(plan->memory);
+    free(plan);
+}
+
+void firFftFilter(FirFftPlan* plan, const short* input, size_t outputCount, float* output) {
+    const size_t inputCount = outputCount + plan->tapsCount - 1;
+    const size_t span = 2 * FIR_FFT_LANES * plan->hop;
+    for(size_t first = 0; first < outputCount; first += span){
+        plan->batch(plan, input, inputCount, first, outputCount, output);
+    }
+}
+
+struct FirFftCl {
+    FirClEnv env;
+    size_t tapsCount;
+    size_t fftSize;
+    size_t hop;
+    size_t maxSegments;
+    cl_mem segments[2];
+    cl_mem spectrum;
+    cl_mem twiddles;
+    cl_kernel load;
+    cl_kernel radix2;
+    cl_kernel multiply;
+    cl_kernel store;
+};
+
+// Device buffers and kernels of plan; host is the CPU plan for the same taps
+static cl_int setupCl(FirFftCl* plan, const FirClEnv* env, const FirFftPlan* host) {
+    cl_int status;
+    const size_t segmentBytes = plan->maxSegments * plan->fftSize * sizeof(cl_float) * 2;
+    for(int i = 0; i < 2; i++){
+        plan->segments[i] = clCreateBuffer(env->context, CL_MEM_READ_WRITE, segmentBytes, NULL, &status);
+        if(status != CL_SUCCESS)
+            return status;
+    }
+
+    // The spectrum comes from the CPU plan; twiddles are the first half of its table
+    FirComplex* twiddles = (FirComplex*)malloc(sizeof(FirComplex) * plan->fftSize/2);
+    if(twiddles == NULL)
+        return CL_OUT_OF_HOST_MEMORY;
+    for(size_t m = 0; m < plan->fftSize/2; m++){
+        twiddles[m].re = host->twiddleRe[m];
+        twiddles[m].im = host->twiddleIm[m];
+    }
+    plan->spectrum = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                    sizeof(FirComplex) * plan->fftSize, host->spectrum, &status);
+    if(status == CL_SUCCESS)
+        plan->twiddles = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                        sizeof(FirComplex) * plan->fftSize/2, twiddles, &status);
+    free(twiddles);
+    if(status != CL_SUCCESS)
+        return status;
+
+    plan->load = clCreateKernel(env->program, "OsLoad", &status);
+    if(status != CL_SUCCESS)
+        return status;
+    plan->radix2 = clCreateKernel(env->program, "FftRadix2", &status);
+    if(status != CL_SUCCESS)
+        return status;
+    plan->multiply = clCreateKernel(env->program, "OsMultiply", &status);
+    if(status != CL_SUCCESS)
+        return status;
+    plan->store = clCreateKernel(env->program, "OsStore", &status);
+    return status;
+}
+
+FirFftCl* firFftClCreate(const FirClEnv* env, const float* taps, size_t tapsCount, size_t maxOutputs, cl_int* status) {
+    cl_int result = CL_SUCCESS;
+    if(status == NULL)
+        status = &result;
+    *status = CL_OUT_OF_HOST_MEMORY;
+    FirFftPlan* host = firFftCreate(taps, tapsCount);
+    if(host == NULL)
+        return NULL;
+    FirFftCl* plan = (FirFftCl*)calloc(1, sizeof(FirFftCl));
+    if(plan == NULL){
+        firFftDestroy(host);
+        return NULL;
+    }
+    plan->env = *env;
+    plan->tapsCount = tapsCount;
+    plan->fftSize = host->fftSize;
+    plan->hop = host->hop;
+    plan->maxSegments = (maxOutputs + plan->hop - 1) / plan->hop;
+    *status = setupCl(plan, env, host);
+    firFftDestroy(host);
+    if(*status != CL_SUCCESS){
+        firFftClDestroy(plan);
+        return NULL;
+    }
+    return plan;
+}
+
+void firFftClDestroy(FirFftCl* plan) {
+    if(plan == NULL)
+        return;
+    for(int i = 0; i < 2; i++){
+        if(plan->segments[i])
+            clReleaseMemObject(plan->segments[i]);
+    }
+    if(plan->spectrum)
+        clReleaseMemObject(plan->spectrum);
+    if(plan->twiddles)
+        clReleaseMemObject(plan->twiddles);
+    if(plan->load)
+        clReleaseKernel(plan->load);
+    if(plan->radix2)
+        clReleaseKernel(plan->radix2);
+    if(plan->multiply)
+        clReleaseKernel(plan->multiply);
+    if(plan->store)
+        clReleaseKernel(plan->store);
+    free(plan);
+}
+
+// One launch of the FFT pipeline over global_work_size items, traced as a kernel call
+static cl_int enqueueKernel(FirFftCl* plan, cl_kernel kernel, const size_t* global_work_size, const char* name,
+                            size_t samples) {
+    FirTraceCall trace;
+    cl_int status = clEnqueueNDRangeKernel(plan->env.queue, kernel, 1, NULL, global_work_size, NULL, 0, NULL,
+                                           firTraceBegin(&trace, NULL));
+    firTraceEnd(&trace, NULL, FIR_TRACE_KERNEL, name, status, 0, samples);
+    return status;
+}
+
+// Forward FFT of every segment, ping-ponging between the two segment buffers
+static cl_int enqueueFft(FirFftCl* plan, size_t segmentCount, int* at) {
+    cl_int status = CL_SUCCESS;
+    cl_uint fftSize = (cl_uint)plan->fftSize;
+    size_t global_work_size[1] = {segmentCount * plan->fftSize / 2};
+    for(cl_uint p = 1; p < fftSize && status == CL_SUCCESS; p *= 2){
+        status  = clSetKernelArg(plan->radix2, 0, sizeof(cl_mem), &plan->segments[*at]);
+        status |= clSetKernelArg(plan->radix2, 1, sizeof(cl_mem), &plan->segments[!*at]);
+        status |= clSetKernelArg(plan->radix2, 2, sizeof(cl_mem), &plan->twiddles);
+        status |= clSetKernelArg(plan->radix2, 3, sizeof(cl_uint), &p);
+        status |= clSetKernelArg(plan->radix2, 4, sizeof(cl_uint), &fftSize);
+        if(status == CL_SUCCESS)
+            status = enqueueKernel(plan, plan->radix2, global_work_size, "FftRadix2", 0);
+        *at = !*at;
+    }
+    return status;
+}
+
+cl_int firFftClEnqueue(FirFftCl* plan, cl_mem input, size_t outputCount, cl_mem output) {
+    if(outputCount == 0)
+        return CL_SUCCESS;
+    const size_t segmentCount = (outputCount + plan->hop - 1) / plan->hop;
+    if(segmentCount > plan->maxSegments)
+        return CL_INVALID_VALUE;
+    cl_int status;
+    cl_uint hop = (cl_uint)plan->hop;
+    cl_uint fftSize = (cl_uint)plan->fftSize;
+    cl_uint history = (cl_uint)plan->tapsCount - 1;
+    cl_uint inputCount = (cl_uint)(outputCount + history);
+    cl_uint count = (cl_uint)outputCount;
+    int at = 0;
+
+    size_t global_work_size[1] = {segmentCount * plan->fftSize};
+    status  = clSetKernelArg(plan->load, 0, sizeof(cl_mem), &input);
+    status |= clSetKernelArg(plan->load, 1, sizeof(cl_mem), &plan->segments[at]);
+    status |= clSetKernelArg(plan->load, 2, sizeof(cl_uint), &hop);
+    status |= clSetKernelArg(plan->load, 3, sizeof(cl_uint), &fftSize);
+    status |= clSetKernelArg(plan->load, 4, sizeof(cl_uint), &inputCount);
+    if(status == CL_SUCCESS)
+        status = enqueueKernel(plan, plan->load, global_work_size, "FftLoad", 0);
+    if(status == CL_SUCCESS)
+        status = enqueueFft(plan, segmentCount, &at);
+    if(status != CL_SUCCESS)
+        return status;
+
+    status  = clSetKernelArg(plan->multiply, 0, sizeof(cl_mem), &plan->segments[at]);
+    status |= clSetKernelArg(plan->multiply, 1, sizeof(cl_mem), &plan->spectrum);
+    status |= clSetKernelArg(plan->multiply, 2, sizeof(cl_uint), &fftSize);
+    if(status == CL_SUCCESS)
+        status = enqueueKernel(plan, plan->multiply, global_work_size, "FftMultiply", 0);
+    if(status == CL_SUCCESS)
+        status = enqueueFft(plan, segmentCount, &at);
+    if(status != CL_SUCCESS)
+        return status;
+
+    global_work_size[0] = segmentCount * plan->hop;
+    status  = clSetKernelArg(plan->store, 0, sizeof(cl_mem), &plan->segments[at]);
+    status |= clSetKernelArg(plan->store, 1, sizeof(cl_mem), &output);
+    status |= clSetKernelArg(plan->store, 2, sizeof(cl_uint), &hop);
+    status |= clSetKernelArg(plan->store, 3, sizeof(cl_uint), &fftSize);
+    status |= clSetKernelArg(plan->store, 4, sizeof(cl_uint), &history);
+    status |= clSetKernelArg(plan->store, 5, sizeof(cl_uint), &count);
+    if(status == CL_SUCCESS)
+        status = enqueueKernel(plan, plan->store, global_work_size, "FftStore", outputCount);
+    return status;
+}
+
+static double elapsedSeconds(const struct timeval* start) {
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    return (end.tv_sec - start->tv_sec) + (end.tv_usec - start->tv_usec) * 1e-6;
+}
+
+// Measured OpenCL crossovers, one per device
+typedef struct FirFftCrossover {
+    cl_device_id device;
+    size_t crossover;
+    struct FirFftCrossover* next;
+} FirFftCrossover;
+
+static size_t cpuCrossover = 0;
+static FirFftCrossover* crossovers = NULL;
+static pthread_mutex_t crossoverLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Best of FIR_FFT_CROSSOVER_REPS direct and FFT passes after one warm-up of each
+static void measureCpu(const short* input, size_t outputCount, const float* taps, size_t tapsCount,
+                       FirFftPlan* plan, float* output, double* direct, double* viaFft) {
+    *direct = *viaFft = -1.0;
+    for(int rep = 0; rep <= FIR_FFT_CROSSOVER_REPS; rep++){
+        struct timeval start;
+        gettimeofday(&start, NULL);
+        firSimd(input, outputCount, taps, tapsCount, output);
+        const double directTime = elapsedSeconds(&start);
+        gettimeofday(&start, NULL);
+        firFftFilter(plan, input, outputCount, output);
+        const double fftTime = elapsedSeconds(&start);
+        if(rep > 0 && (*direct < 0 || directTime < *direct))
+            *direct = directTime;
+        if(rep > 0 && (*viaFft < 0 || fftTime < *viaFft))
+            *viaFft = fftTime;
+    }
+}
+
+// Double the tap count until one overlap-save pass beats firSimd on the same block
+size_t firFftCrossover() {
+    // Held across the measurement so concurrent callers wait for one result
+    pthread_mutex_lock(&crossoverLock);
+    if(cpuCrossover){
+        pthread_mutex_unlock(&crossoverLock);
+        return cpuCrossover;
+    }
+    const size_t outputCount = 1 << 15;
+    const size_t maxTaps = 8192;
+    short* input = (short*)calloc(outputCount + maxTaps, sizeof(short));
+    float* taps = (float*)calloc(maxTaps, sizeof(float));
+    float* output = (float*)malloc(sizeof(float) * outputCount);
+    size_t found = maxTaps;
+    if(input != NULL && taps != NULL && output != NULL){
+        for(size_t tapsCount = 16; tapsCount < maxTaps; tapsCount *= 2){
+            FirFftPlan* plan = firFftCreate(taps, tapsCount);
+            if(plan == NULL)
+                break;
+            double direct, viaFft;
+            measureCpu(input, outputCount, taps, tapsCount, plan, output, &direct, &viaFft);
+            firFftDestroy(plan);
+            if(viaFft < direct){
+                found = tapsCount;
+                break;
+            }
+        }
+    }
+    free(input);
+    free(taps);
+    free(output);
+    cpuCrossover = found;
+    pthread_mutex_unlock(&crossoverLock);
+    return found;
+}
+
+// Best of FIR_FFT_CROSSOVER_REPS launches after one warm-up, timing each with clFinish;
+// direct is NULL for the FFT plan. Negative with the launch error in status on failure.
+static double measureCl(const FirClEnv* env, const FirClFilter* direct, FirFftCl* plan, cl_mem input, cl_mem output,
+                        cl_mem taps, size_t tapsCount, size_t outputCount, cl_int* status) {
+    double best = -1.0;
+    for(int rep = 0; rep <= FIR_FFT_CROSSOVER_REPS; rep++){
+        struct timeval start;
+        clFinish(env->queue);
+        gettimeofday(&start, NULL);
+        *status = direct != NULL
+            ? firClEnqueueFilter(env, direct, input, output, taps, (cl_uint)tapsCount, (cl_uint)outputCount, NULL)
+            : firFftClEnqueue(plan, input, outputCount, output);
+        if(*status == CL_SUCCESS)
+            *status = clFinish(env->queue);
+        if(*status != CL_SUCCESS)
+            return -1.0;
+        const double time = elapsedSeconds(&start);
+        if(rep > 0 && (best < 0 || time < best))
+            best = time;
+    }
+    return best;
+}
+
+// The search of firFftCrossover on the device
+static cl_int searchCl(const FirClEnv* env, size_t* crossover) {
+    const size_t outputCount = 1 << 18;
+    const size_t maxTaps = 8192;
+    cl_int status = CL_OUT_OF_HOST_MEMORY;
+    cl_mem input = NULL, output = NULL, tapsMem = NULL;
+    // Zeroed like fir_tune's probes: uninitialised memory may hold NaNs or denormals
+    short* zeros = (short*)calloc(outputCount + maxTaps, sizeof(short));
+    float* taps = (float*)calloc(maxTaps, sizeof(float));
+    if(zeros != NULL && taps != NULL)
+        input = clCreateBuffer(env->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                               (outputCount + maxTaps) * sizeof(short), zeros, &status);
+    if(input != NULL)
+        output = clCreateBuffer(env->context, CL_MEM_READ_WRITE, outputCount * sizeof(float), NULL, &status);
+    if(output != NULL)
+        tapsMem = clCreateBuffer(env->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                 maxTaps * sizeof(float), taps, &status);
+
+    *crossover = maxTaps;
+    for(size_t tapsCount = 16; tapsMem != NULL && tapsCount < maxTaps; tapsCount *= 2){
+        FirClFilter direct;
+        status = firClCreateFilter(env, tapsCount, FIR_INPUT_INT16, 0, &direct);
+        const double viaDirect = status == CL_SUCCESS
+            ? measureCl(env, &direct, NULL, input, output, tapsMem, tapsCount, outputCount, &status) : -1.0;
+        firClReleaseFilter(&direct);
+        if(status != CL_SUCCESS)
+            break;
+
+        FirFftCl* plan = firFftClCreate(env, taps, tapsCount, outputCount, &status);
+        if(plan == NULL)
+            break;
+        const double viaFft = measureCl(env, NULL, plan, input, output, tapsMem, tapsCount, outputCount, &status);
+        firFftClDestroy(plan);
+        if(status != CL_SUCCESS)
+            break;
+        if(viaFft < viaDirect){
+            *crossover = tapsCount;
+            break;
+        }
+    }
+    free(zeros);
+    free(taps);
+    if(tapsMem)
+        clReleaseMemObject(tapsMem);
+    if(output)
+        clReleaseMemObject(output);
+    if(input)
+        clReleaseMemObject(input);
+    return status;
+}
+
+cl_int firFftClCrossover(const FirClEnv* env, size_t* crossover) {
+    pthread_mutex_lock(&crossoverLock);
+    for(FirFftCrossover* known = crossovers; known != NULL; known = known->next){
+        if(known->device == env->device){
+            *crossover = known->crossover;
+            pthread_mutex_unlock(&crossoverLock);
+            return CL_SUCCESS;
+        }
+    }
+    // Failed searches are not cached, so a later call measures again
+    const cl_int status = searchCl(env, crossover);
+    if(status == CL_SUCCESS){
+        FirFftCrossover* known = (FirFftCrossover*)malloc(sizeof(FirFftCrossover));
+        if(known != NULL){
+            *known = (FirFftCrossover){ env->device, *crossover, crossovers };
+            crossovers = known;
+        }
+    }
+    pthread_mutex_unlock(&crossoverLock);
+    return status;
+}
+
+void firFftReleaseCrossovers() {
+    pthread_mutex_lock(&crossoverLock);
+    while(crossovers != NULL){
+        FirFftCrossover* next = crossovers->next;
+        free(crossovers);
+        crossovers = next;
+    }
+    cpuCrossover = 0;
+    pthread_mutex_unlock(&crossoverLock);
+}
@@ -0,0 +1,39 @@
+#ifndef FIR_FFT_H
+#define FIR_FFT_H
+#include <stddef.h>
+#include "fir_cl.h"
+
+// Overlap-save FFT convolution. Each segment of fftSize input samples yields
+// fftSize - tapsCount + 1 outputs. The tap spectrum is computed once per plan.
+// Results follow the firSimd convention (input holds outputCount + tapsCount - 1 samples).
+// Rounding error is spread over a whole segment, so it is bounded relative to
+// max|input| * sum|taps| (about 1e-6 of it) rather than per output like the direct kernels.
+
+typedef struct FirFftPlan FirFftPlan;
+typedef struct FirFftCl FirFftCl;
+
+// CPU plan; it owns scratch buffers, so use one plan per thread
+FirFftPlan* firFftCreate(const float* taps, size_t tapsCount);
+void firFftDestroy(FirFftPlan* plan);
+void firFftFilter(FirFftPlan* plan, const short* input, size_t outputCount, float* output);
+
+// OpenCL plan for at most maxOutputs outputs per call; buffers and the spectrum stay on the
+// device. NULL on failure, with the reason in status (may be NULL).
+FirFftCl* firFftClCreate(const FirClEnv* env, const float* taps, size_t tapsCount, size_t maxOutputs,
+                         cl_int* status);
+void firFftClDestroy(FirFftCl* plan);
+// Enqueue on env->queue; input/output are device buffers laid out like FirFilter's
+cl_int firFftClEnqueue(FirFftCl* plan, cl_mem input, size_t outputCount, cl_mem output);
+
+// Warm-up plus this many timed passes per engine and tap count; the best one counts
+#define FIR_FFT_CROSSOVER_REPS 3
+
+// Tap count from which FFT beats direct convolution, measured on first call and cached.
+// The OpenCL figure is measured on env's device and cached per device; a failed
+// measurement returns its error and is retried by the next call. Safe to call from
+// several threads.
+size_t firFftCrossover();
+cl_int firFftClCrossover(const FirClEnv* env, size_t* crossover);
+// Forget the measured crossovers
+void firFftReleaseCrossovers();
+#endif // FIR_FFT_H
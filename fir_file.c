@@ -0,0 +1,272 @@
+#include "fir_file.h"
+#include "cpu_simd.h"
+#include "fir_pipeline.h"
+#include "fir_plan.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A file opened for mapping, and one mapped range of it
+typedef struct {
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+    bool writable;
+} FirFile;
+
+typedef struct {
+    void* base;       // start of the mapping, aligned down to the mapping granularity
+    size_t length;
+    void* data;       // the requested offset
+} FirFileView;
+
+#ifdef _WIN32
+static size_t granularity() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+}
+
+static bool openFile(const char* path, bool writable, uint64_t size, FirFile* file, uint64_t* fileSize) {
+    file->writable = writable;
+    file->mapping = NULL;
+    // FILE_FLAG_SEQUENTIAL_SCAN is the Windows counterpart of MADV_SEQUENTIAL
+    file->file = CreateFileA(path, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                             writable ? 0 : FILE_SHARE_READ, NULL, writable ? CREATE_ALWAYS : OPEN_EXISTING,
+                             FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file->file == INVALID_HANDLE_VALUE){
+        printf("Open file failed: %s\n", path);
+        return false;
+    }
+    LARGE_INTEGER length;
+    if(writable){
+        length.QuadPart = (LONGLONG)size;
+        if(!SetFilePointerEx(file->file, length, NULL, FILE_BEGIN) || !SetEndOfFile(file->file)){
+            printf("Failed to size %s\n", path);
+            CloseHandle(file->file);
+            return false;
+        }
+    }
+    else{
+        GetFileSizeEx(file->file, &length);
+        size = (uint64_t)length.QuadPart;
+    }
+    *fileSize = size;
+    // Empty files cannot be mapped, and have nothing to map
+    if(size > 0){
+        file->mapping = CreateFileMappingA(file->file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                           (DWORD)(size >> 32), (DWORD)size, NULL);
+        if(file->mapping == NULL){
+            printf("Failed to map %s\n", path);
+            CloseHandle(file->file);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void closeFile(FirFile* file) {
+    if(file->mapping)
+        CloseHandle(file->mapping);
+    CloseHandle(file->file);
+}
+
+static bool mapView(FirFile* file, uint64_t offset, size_t length, FirFileView* view) {
+    const uint64_t aligned = offset & ~(uint64_t)(granularity() - 1);
+    view->length = length + (size_t)(offset - aligned);
+    view->base = MapViewOfFile(file->mapping, file->writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                               (DWORD)(aligned >> 32), (DWORD)aligned, view->length);
+    view->data = (char*)view->base + (offset - aligned);
+    return view->base != NULL;
+}
+
+static void unmapView(FirFile* file, FirFileView* view) {
+    if(file->writable)
+        FlushViewOfFile(view->base, 0);
+    UnmapViewOfFile(view->base);
+}
+
+// Nothing to drop: Windows trims the standby list of unmapped views on its own
+static void dropCache(FirFile* file, uint64_t offset, uint64_t length) {
+    (void)file;
+    (void)offset;
+    (void)length;
+}
+#else
+static size_t granularity() {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static bool openFile(const char* path, bool writable, uint64_t size, FirFile* file, uint64_t* fileSize) {
+    file->writable = writable;
+    file->fd = writable ? open(path, O_RDWR | O_CREAT | O_TRUNC, 0644) : open(path, O_RDONLY);
+    if(file->fd < 0){
+        printf("Open file failed: %s\n", path);
+        return false;
+    }
+    if(writable){
+        if(ftruncate(file->fd, (off_t)size) != 0){
+            printf("Failed to size %s\n", path);
+            close(file->fd);
+            return false;
+        }
+    }
+    else{
+        struct stat info;
+        fstat(file->fd, &info);
+        size = (uint64_t)info.st_size;
+        posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    *fileSize = size;
+    return true;
+}
+
+static void closeFile(FirFile* file) {
+    close(file->fd);
+}
+
+static bool mapView(FirFile* file, uint64_t offset, size_t length, FirFileView* view) {
+    const uint64_t aligned = offset & ~(uint64_t)(granularity() - 1);
+    view->length = length + (size_t)(offset - aligned);
+    view->base = mmap(NULL, view->length, file->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                      file->fd, (off_t)aligned);
+    if(view->base == MAP_FAILED){
+        view->base = NULL;
+        return false;
+    }
+    if(!file->writable)
+        madvise(view->base, view->length, MADV_SEQUENTIAL);
+    view->data = (char*)view->base + (offset - aligned);
+    return true;
+}
+
+static void unmapView(FirFile* file, FirFileView* view) {
+    // Start writeback now so dirty pages do not pile up until the end
+    if(file->writable)
+        msync(view->base, view->length, MS_ASYNC);
+    munmap(view->base, view->length);
+}
+
+// Input already consumed will not be read again: let the page cache drop it
+static void dropCache(FirFile* file, uint64_t offset, uint64_t length) {
+    posix_fadvise(file->fd, (off_t)offset, (off_t)length, POSIX_FADV_DONTNEED);
+}
+#endif
+
+static void toInt16(const float* input, size_t count, short* output) {
+    for(size_t i = 0; i < count; i++){
+        const float value = nearbyintf(input[i]);
+        output[i] = value >= 32767.0f ? 32767 : value <= -32768.0f ? -32768 : (short)value;
+    }
+}
+
+bool firFileFilter(const char* inputPath, const char* outputPath, FirFileFormat format,
+                   const float* taps, size_t tapsCount, FirBackend backend, const FirClEnv* env,
+                   FirPool* pool, FirFileStats* stats) {
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+    if(tapsCount == 0)
+        return false;
+    const size_t history = tapsCount - 1;
+    const size_t outputSize = format == FIR_FILE_INT16 ? sizeof(short) : sizeof(float);
+
+    FirFile input, output;
+    uint64_t inputSize, outputBytes;
+    if(!openFile(inputPath, false, 0, &input, &inputSize))
+        return false;
+    const uint64_t samples = inputSize / sizeof(short);
+    if(!openFile(outputPath, true, samples * outputSize, &output, &outputBytes)){
+        closeFile(&input);
+        return false;
+    }
+
+    // The first tapsCount-1 outputs reach back before the file: filtered from a padded copy
+    short* head = (short*)calloc(2 * history + 1, sizeof(short));
+    // Float results of a window when writing int16
+    float* scratch = format == FIR_FILE_INT16 ? (float*)malloc(sizeof(float) * FIR_FILE_WINDOW) : NULL;
+    FirTapPlan* plan = backend == FIR_BACKEND_CPU ? firTapPlanCreate(taps, tapsCount) : NULL;
+    cl_int setup = CL_SUCCESS;
+    FirPipeline* pipeline = backend == FIR_BACKEND_OPENCL ? firPipelineCreate(env, taps, tapsCount, FIR_FILE_CHUNK, 0, &setup) : NULL;
+    bool ok = head != NULL && (format != FIR_FILE_INT16 || scratch != NULL) &&
+              (backend == FIR_BACKEND_CPU ? plan != NULL : pipeline != NULL);
+    if(!ok)
+        printf("Failed to set up the file filter (Error = %d)\n", setup);
+
+    for(uint64_t w0 = 0; ok && w0 < samples; w0 += FIR_FILE_WINDOW){
+        const size_t count = (size_t)(samples - w0 < FIR_FILE_WINDOW ? samples - w0 : FIR_FILE_WINDOW);
+        // Input [first, w0 + count) covers the halo of the window's first output
+        const uint64_t first = w0 > history ? w0 - history : 0;
+        FirFileView in, out;
+        if(!mapView(&input, first * sizeof(short), (size_t)(w0 + count - first) * sizeof(short), &in)){
+            printf("Failed to map %s\n", inputPath);
+            ok = false;
+            break;
+        }
+        if(!mapView(&output, w0 * outputSize, count * outputSize, &out)){
+            printf("Failed to map %s\n", outputPath);
+            unmapView(&input, &in);
+            ok = false;
+            break;
+        }
+        const short* x = (const short*)in.data;
+        float* y = format == FIR_FILE_INT16 ? scratch : (float*)out.data;
+
+        // Outputs [w0, headEnd) see zeros before the file start
+        const size_t headEnd = w0 < history ? (size_t)(history < w0 + count ? history : w0 + count) : (size_t)w0;
+        if(headEnd > w0){
+            memset(head, 0, history * sizeof(short));
+            memcpy(head + history, x, headEnd * sizeof(short));
+            firSimd(head + w0, headEnd - w0, taps, tapsCount, y);
+        }
+        // The rest read their history straight from the mapping
+        const size_t bodyCount = (size_t)(w0 + count - headEnd);
+        if(bodyCount > 0 && backend == FIR_BACKEND_CPU){
+            firTapPlanFilter(plan, pool, x + (headEnd - history - first), bodyCount, y + (headEnd - w0));
+        }
+        else if(bodyCount > 0){
+            cl_int status = firPipelineSubmit(pipeline, x + (headEnd - history - first), bodyCount, y + (headEnd - w0), NULL, NULL);
+            if(status == CL_SUCCESS)
+                status = firPipelineFinish(pipeline);
+            if(status != CL_SUCCESS){
+                printf("Failed to filter %s (Error = %d)\n", inputPath, status);
+                ok = false;
+            }
+        }
+        if(format == FIR_FILE_INT16)
+            toInt16(scratch, count, (short*)out.data);
+
+        unmapView(&output, &out);
+        unmapView(&input, &in);
+        // Everything before the next window's halo is done with
+        const uint64_t next = w0 + count > history ? w0 + count - history : 0;
+        if(next > first)
+            dropCache(&input, first * sizeof(short), (next - first) * sizeof(short));
+    }
+
+    firPipelineDestroy(pipeline);
+    firTapPlanDestroy(plan);
+    free(scratch);
+    free(head);
+    closeFile(&output);
+    closeFile(&input);
+    gettimeofday(&end, NULL);
+    if(stats != NULL){
+        stats->samples = (size_t)samples;
+        stats->seconds = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    }
+    return ok;
+}
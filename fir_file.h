@@ -0,0 +1,36 @@
+#ifndef FIR_FILE_H
+#define FIR_FILE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu_pool.h"
+#include "fir_cl.h"
+#include "fir_stream.h"
+
+// Output sample formats of firFileFilter
+typedef enum {
+    FIR_FILE_FLOAT32 = 0,
+    FIR_FILE_INT16           // rounded to nearest and saturated
+} FirFileFormat;
+
+// Outputs per mapped window: the input and output files are mapped this much at a time,
+// so memory use is bounded whatever the file size
+#define FIR_FILE_WINDOW (1 << 22)
+// Outputs per chunk handed to the OpenCL pipeline
+#define FIR_FILE_CHUNK (1 << 18)
+
+typedef struct {
+    size_t samples;     // input samples read (= outputs written)
+    double seconds;     // wall time from open to close
+} FirFileStats;
+
+// Filter a raw native-endian int16 file into a raw file of one output per input sample,
+// causal like FirStream (the first tapsCount-1 outputs see zeros before the file start).
+// Input windows are mapped read-only and read sequentially, every window overlapping the
+// previous one by the tapsCount-1 sample halo. The CPU filters straight from the input
+// mapping into the output mapping; OpenCL runs a FirPipeline over the same mappings.
+// env is only used for FIR_BACKEND_OPENCL, pool only for FIR_BACKEND_CPU (may be NULL).
+// Prints the reason and returns false when a file cannot be opened, sized or mapped.
+bool firFileFilter(const char* inputPath, const char* outputPath, FirFileFormat format,
+                   const float* taps, size_t tapsCount, FirBackend backend, const FirClEnv* env,
+                   FirPool* pool, FirFileStats* stats);
+#endif // FIR_FILE_H
@@ -0,0 +1,193 @@
+#include "fir_filter.h"
+#include "fir_buffer.h"
+#include "fir_cache.h"
+#include "fir_plan.h"
+#include "fir_tune.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef FIR_EMBED_KERNEL
+extern const char firKernelSource[];
+#endif
+
+struct FirFilter {
+    pthread_mutex_t lock;
+    FirBackend backend;
+    size_t tapsCount;
+    size_t maxOutputs;
+    FirTapPlan* plan;
+    FirPool* pool;
+    char name[128];
+
+    FirClEnv env;            // owned: context, queue and program of this filter alone
+    FirClTapPlan clPlan;     // planned kernel when the taps have structure, else
+    FirClFilter clFilter;    // the tuned direct kernel
+    cl_mem input;
+    cl_mem output;
+    cl_mem taps;
+};
+
+// First device of the wanted type on any platform; type 0 tries GPUs, then anything
+static cl_int pickDevice(cl_device_type type, cl_device_id* device) {
+    cl_uint platformCount = 0;
+    cl_int status = clGetPlatformIDs(0, NULL, &platformCount);
+    if(status != CL_SUCCESS)
+        return status;
+    if(platformCount == 0)
+        return CL_DEVICE_NOT_FOUND;
+    cl_platform_id* platforms = (cl_platform_id*)malloc(sizeof(cl_platform_id) * platformCount);
+    if(platforms == NULL)
+        return CL_OUT_OF_HOST_MEMORY;
+    status = clGetPlatformIDs(platformCount, platforms, NULL);
+    const cl_device_type wanted[2] = { type ? type : CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL };
+    const int passes = type ? 1 : 2;
+    cl_int found = CL_DEVICE_NOT_FOUND;
+    for(int pass = 0; status == CL_SUCCESS && pass < passes && found != CL_SUCCESS; pass++){
+        for(cl_uint p = 0; p < platformCount && found != CL_SUCCESS; p++){
+            cl_uint count = 0;
+            if(clGetDeviceIDs(platforms[p], wanted[pass], 1, device, &count) == CL_SUCCESS && count > 0)
+                found = CL_SUCCESS;
+        }
+    }
+    free(platforms);
+    return status != CL_SUCCESS ? status : found;
+}
+
+static cl_int setupOpenCL(FirFilter* filter, const FirFilterConfig* config) {
+    cl_int status;
+    const char* source = config->source;
+#ifdef FIR_EMBED_KERNEL
+    if(source == NULL)
+        source = firKernelSource;
+#endif
+    if(source == NULL)
+        return CL_INVALID_VALUE;
+    status = pickDevice(config->deviceType, &filter->env.device);
+    if(status != CL_SUCCESS)
+        return status;
+    clGetDeviceInfo(filter->env.device, CL_DEVICE_NAME, sizeof(filter->name), filter->name, NULL);
+    filter->name[sizeof(filter->name) - 1] = '\0';
+    filter->env.source = source;
+    filter->env.context = clCreateContext(NULL, 1, &filter->env.device, NULL, NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    filter->env.queue = clCreateCommandQueue(filter->env.context, filter->env.device, CL_QUEUE_PROFILING_ENABLE, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    filter->env.program = firClBuildCached(filter->env.context, filter->env.device, source, NULL, NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    if(firClTapPlanCreate(&filter->env, filter->plan, &filter->clPlan) != CL_SUCCESS){
+        status = firClCreateTunedFilter(&filter->env, filter->tapsCount, filter->maxOutputs, &filter->clFilter);
+        if(status != CL_SUCCESS)
+            return status;
+    }
+    // Pooled buffers: host-visible on zero-copy devices, so transfers become maps
+    filter->input = firClBufferAcquire(&filter->env, CL_MEM_READ_ONLY,
+                                       (filter->maxOutputs + filter->tapsCount - 1) * sizeof(short), NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    filter->output = firClBufferAcquire(&filter->env, CL_MEM_WRITE_ONLY, filter->maxOutputs * sizeof(float), NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    filter->taps = clCreateBuffer(filter->env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  filter->tapsCount * sizeof(float), (void*)config->taps, &status);
+    return status;
+}
+
+FirFilter* firFilterCreate(const FirFilterConfig* config, cl_int* status) {
+    cl_int result = CL_SUCCESS;
+    if(status == NULL)
+        status = &result;
+    if(config->tapsCount == 0 || config->taps == NULL){
+        *status = CL_INVALID_VALUE;
+        return NULL;
+    }
+    FirFilter* filter = (FirFilter*)calloc(1, sizeof(FirFilter));
+    if(filter == NULL){
+        *status = CL_OUT_OF_HOST_MEMORY;
+        return NULL;
+    }
+    pthread_mutex_init(&filter->lock, NULL);
+    filter->backend = config->backend;
+    filter->tapsCount = config->tapsCount;
+    filter->maxOutputs = config->maxOutputs ? config->maxOutputs : FIR_FILTER_DEFAULT_OUTPUTS;
+    filter->pool = config->pool;
+    snprintf(filter->name, sizeof(filter->name), "CPU");
+    filter->plan = firTapPlanCreate(config->taps, config->tapsCount);
+    *status = filter->plan != NULL ? CL_SUCCESS : CL_OUT_OF_HOST_MEMORY;
+    if(*status == CL_SUCCESS && config->backend == FIR_BACKEND_OPENCL)
+        *status = setupOpenCL(filter, config);
+    if(*status != CL_SUCCESS){
+        firFilterDestroy(filter);
+        return NULL;
+    }
+    return filter;
+}
+
+void firFilterDestroy(FirFilter* filter) {
+    if(filter == NULL)
+        return;
+    firClTapPlanRelease(&filter->clPlan);
+    firClReleaseFilter(&filter->clFilter);
+    firClBufferRelease(filter->input);
+    firClBufferRelease(filter->output);
+    if(filter->taps)
+        clReleaseMemObject(filter->taps);
+    if(filter->env.context){
+        firClReleaseContextVariants(filter->env.context);
+        firClReleaseContextBuffers(filter->env.context);
+    }
+    if(filter->env.program)
+        clReleaseProgram(filter->env.program);
+    if(filter->env.queue)
+        clReleaseCommandQueue(filter->env.queue);
+    if(filter->env.context)
+        clReleaseContext(filter->env.context);
+    firTapPlanDestroy(filter->plan);
+    pthread_mutex_destroy(&filter->lock);
+    free(filter);
+}
+
+static cl_int executeOpenCL(FirFilter* filter, const short* input, size_t outputCount, float* output) {
+    cl_int status;
+    const FirClEnv* env = &filter->env;
+    status = firClBufferWrite(env, filter->input, (outputCount + filter->tapsCount - 1) * sizeof(short), input, NULL);
+    if(status != CL_SUCCESS)
+        return status;
+    if(filter->clPlan.kernel)
+        status = firClEnqueueTapPlan(env, filter->plan, &filter->clPlan, filter->input, filter->output, (cl_uint)outputCount, NULL);
+    else
+        status = firClEnqueueFilter(env, &filter->clFilter, filter->input, filter->output, filter->taps,
+                                    (cl_uint)filter->tapsCount, (cl_uint)outputCount, NULL);
+    if(status != CL_SUCCESS)
+        return status;
+    return firClBufferRead(env, filter->output, outputCount * sizeof(float), output, NULL);
+}
+
+cl_int firFilterExecute(FirFilter* filter, const short* input, size_t outputCount, float* output) {
+    cl_int status = CL_SUCCESS;
+    pthread_mutex_lock(&filter->lock);
+    if(filter->backend == FIR_BACKEND_CPU){
+        firTapPlanFilter(filter->plan, filter->pool, input, outputCount, output);
+    }
+    else{
+        // Launches of at most maxOutputs, each reading its tapsCount-1 halo from the next
+        for(size_t first = 0; first < outputCount && status == CL_SUCCESS; first += filter->maxOutputs){
+            const size_t count = outputCount - first < filter->maxOutputs ? outputCount - first : filter->maxOutputs;
+            status = executeOpenCL(filter, input + first, count, output + first);
+        }
+    }
+    pthread_mutex_unlock(&filter->lock);
+    return status;
+}
+
+size_t firFilterTapsCount(const FirFilter* filter) {
+    return filter->tapsCount;
+}
+
+const char* firFilterDeviceName(const FirFilter* filter) {
+    return filter->name;
+}
@@ -0,0 +1,44 @@
+#ifndef FIR_FILTER_H
+#define FIR_FILTER_H
+#include <stddef.h>
+#include <CL/cl.h>
+#include "cpu_pool.h"
+#include "fir_stream.h"
+
+// Outputs one execute call handles per launch when FirFilterConfig.maxOutputs is 0
+#define FIR_FILTER_DEFAULT_OUTPUTS (1 << 20)
+
+// What firFilterCreate plans for
+typedef struct {
+    FirBackend backend;
+    // OpenCL: device type to open (0 = the first GPU, else the first device of any type,
+    // like init()) and the kernel.cl text (NULL = the embedded copy when built with FIR_EMBED_KERNEL)
+    cl_device_type deviceType;
+    const char* source;
+    // CPU: pool the engine spreads over (may be NULL or shared; must outlive the filter)
+    FirPool* pool;
+    const float* taps;       // copied
+    size_t tapsCount;
+    size_t maxOutputs;       // outputs per launch; longer executes are split
+} FirFilterConfig;
+
+// Self-contained filter handle: unlike init()'s globals it owns its own OpenCL context,
+// queue, program, kernel and buffers, so any number can coexist with different taps and
+// sizes. Everything is allocated once in firFilterCreate (tap plan, tuned kernel, device
+// buffers) and reused by every execute. Execute calls on one handle are serialised by its
+// mutex, so several threads may share a handle. Separate handles run in parallel, except
+// that CPU handles sharing a FirPool take turns on its workers. Handles still share the
+// process-wide caches, each behind its own lock: variant programs (fir_cl.h), tuning
+// profiles (fir_tune.h) and the buffer registry (fir_buffer.h).
+typedef struct FirFilter FirFilter;
+
+// NULL on failure with the reason in status (may be NULL)
+FirFilter* firFilterCreate(const FirFilterConfig* config, cl_int* status);
+void firFilterDestroy(FirFilter* filter);
+// output[i] = sum(input[i+j] * taps[j]) for i < outputCount; input holds
+// outputCount + tapsCount - 1 samples. Blocks until output is written.
+cl_int firFilterExecute(FirFilter* filter, const short* input, size_t outputCount, float* output);
+size_t firFilterTapsCount(const FirFilter* filter);
+// Device the filter runs on ("CPU" for the native engine)
+const char* firFilterDeviceName(const FirFilter* filter);
+#endif // FIR_FILTER_H
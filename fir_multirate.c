@@ -0,0 +1,291 @@
+#include "fir_multirate.h"
+#include "cpu_simd.h"
+#include "fir_trace.h"
+#include "fir_buffer.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Taps per vector in the dot products
+#define FIR_RATE_LANES 8
+
+typedef float FirRateLanes __attribute__((vector_size(FIR_RATE_LANES * sizeof(float))));
+typedef short FirRateShorts __attribute__((vector_size(FIR_RATE_LANES * sizeof(short))));
+
+struct FirMultirate {
+    FirBackend backend;
+    FirRateMode mode;
+    size_t factor;
+    size_t tapsCount;    // taps per dot product: all of them (decimate) or one phase (interpolate)
+    size_t maxBlock;
+    float* taps;         // as given (decimate) or firPolyphaseTaps rows (interpolate)
+    // tapsCount-1 samples of history followed by up to maxBlock new samples
+    short* window;
+    size_t phase;        // decimation: window index of the next kept output
+
+    FirClEnv env;
+    cl_kernel kernel;
+    cl_mem inputMem;
+    cl_mem outputMem;
+    cl_mem tapsMem;
+};
+
+// output[k*outputStride] = sum(input[k*inputStride+j] * taps[j]); both modes reduce to this
+static inline __attribute__((always_inline))
+void dotBody(const short* input, size_t inputStride, size_t outputCount, const float* taps, size_t tapsCount,
+             float* output, size_t outputStride) {
+    const size_t vectorTaps = tapsCount - tapsCount % FIR_RATE_LANES;
+    for(size_t k = 0; k < outputCount; k++){
+        const short* x = input + k*inputStride;
+        FirRateLanes acc = {0};
+        for(size_t j = 0; j < vectorTaps; j += FIR_RATE_LANES){
+            FirRateShorts s;
+            FirRateLanes h;
+            memcpy(&s, x + j, sizeof(s));
+            memcpy(&h, taps + j, sizeof(h));
+            acc += __builtin_convertvector(s, FirRateLanes) * h;
+        }
+        float sum = 0;
+        for(size_t lane = 0; lane < FIR_RATE_LANES; lane++)
+            sum += acc[lane];
+        for(size_t j = vectorTaps; j < tapsCount; j++)
+            sum += x[j] * taps[j];
+        output[k*outputStride] = sum;
+    }
+}
+
+static void dotGeneric(const short* input, size_t inputStride, size_t outputCount, const float* taps, size_t tapsCount,
+                       float* output, size_t outputStride) {
+    dotBody(input, inputStride, outputCount, taps, tapsCount, output, outputStride);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+static void dotAvx2(const short* input, size_t inputStride, size_t outputCount, const float* taps, size_t tapsCount,
+                    float* output, size_t outputStride) {
+    dotBody(input, inputStride, outputCount, taps, tapsCount, output, outputStride);
+}
+#endif
+
+static void dot(const short* input, size_t inputStride, size_t outputCount, const float* taps, size_t tapsCount,
+                float* output, size_t outputStride) {
+#if defined(__x86_64__) || defined(__i386__)
+    if(firSimdIsa() >= FIR_ISA_AVX2){
+        dotAvx2(input, inputStride, outputCount, taps, tapsCount, output, outputStride);
+        return;
+    }
+#endif
+    dotGeneric(input, inputStride, outputCount, taps, tapsCount, output, outputStride);
+}
+
+void firDecimate(const short* input, size_t outputCount, const float* taps, size_t tapsCount,
+                 size_t factor, float* output) {
+    dot(input, factor, outputCount, taps, tapsCount, output, 1);
+}
+
+void firInterpolate(const short* input, size_t inputCount, const float* taps, size_t phaseTapsCount,
+                    size_t factor, float* output) {
+    for(size_t r = 0; r < factor; r++)
+        dot(input, 1, inputCount, taps + r*phaseTapsCount, phaseTapsCount, output + r, factor);
+}
+
+size_t firPolyphaseTaps(const float* taps, size_t tapsCount, size_t factor, float* phaseTaps) {
+    // Output m*factor+r of the zero-stuffed stream sees sample m-q through tap
+    // tapsCount-1-(r+q*factor); row r lists those taps oldest sample first
+    const size_t phaseTapsCount = (tapsCount + factor - 1) / factor;
+    for(size_t r = 0; r < factor; r++){
+        for(size_t q = 0; q < phaseTapsCount; q++){
+            const size_t k = r + (phaseTapsCount - 1 - q) * factor;
+            phaseTaps[r*phaseTapsCount + q] = k < tapsCount ? taps[tapsCount - 1 - k] : 0.0f;
+        }
+    }
+    return phaseTapsCount;
+}
+
+cl_int firClEnqueueDecimate(const FirClEnv* env, cl_kernel kernel, cl_mem input, cl_mem output, cl_mem taps,
+                            cl_uint tapsCount, cl_uint factor, cl_uint outputCount, cl_event* event) {
+    cl_int status;
+    status  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+    status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
+    status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &taps);
+    status |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &tapsCount);
+    status |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &factor);
+    status |= clSetKernelArg(kernel, 5, sizeof(cl_uint), &outputCount);
+    if(status != CL_SUCCESS || outputCount == 0)
+        return status;
+    size_t local_work_size[1] = {FIR_CL_LOCAL_SIZE};
+    size_t global_work_size[1] = {((size_t)outputCount + FIR_CL_LOCAL_SIZE - 1) / FIR_CL_LOCAL_SIZE * FIR_CL_LOCAL_SIZE};
+    FirTraceCall trace;
+    status = clEnqueueNDRangeKernel(env->queue, kernel, 1, NULL, global_work_size, local_work_size, 0, NULL,
+                                    firTraceBegin(&trace, event));
+    firTraceEnd(&trace, event, FIR_TRACE_KERNEL, "FirDecimate", status, 0, outputCount);
+    return status;
+}
+
+cl_int firClEnqueueInterpolate(const FirClEnv* env, cl_kernel kernel, cl_mem input, cl_mem output, cl_mem phaseTaps,
+                               cl_uint phaseTapsCount, cl_uint factor, cl_uint inputCount, cl_event* event) {
+    cl_int status;
+    const cl_uint outputCount = inputCount * factor;
+    status  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+    status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
+    status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &phaseTaps);
+    status |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &phaseTapsCount);
+    status |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &factor);
+    status |= clSetKernelArg(kernel, 5, sizeof(cl_uint), &outputCount);
+    if(status != CL_SUCCESS || outputCount == 0)
+        return status;
+    size_t local_work_size[1] = {FIR_CL_LOCAL_SIZE};
+    size_t global_work_size[1] = {((size_t)outputCount + FIR_CL_LOCAL_SIZE - 1) / FIR_CL_LOCAL_SIZE * FIR_CL_LOCAL_SIZE};
+    FirTraceCall trace;
+    status = clEnqueueNDRangeKernel(env->queue, kernel, 1, NULL, global_work_size, local_work_size, 0, NULL,
+                                    firTraceBegin(&trace, event));
+    firTraceEnd(&trace, event, FIR_TRACE_KERNEL, "FirInterpolate", status, 0, outputCount);
+    return status;
+}
+
+// Largest output count one chunk of maxBlock input samples can produce
+static size_t maxOutputs(const FirMultirate* rate) {
+    return rate->mode == FIR_INTERPOLATE ? rate->maxBlock * rate->factor : rate->maxBlock / rate->factor + 1;
+}
+
+static cl_int setupOpenCL(FirMultirate* rate, const FirClEnv* env, size_t tapsSize) {
+    cl_int status;
+    rate->env = *env;
+    rate->kernel = clCreateKernel(env->program, rate->mode == FIR_INTERPOLATE ? "FirInterpolate" : "FirDecimate", &status);
+    if(status != CL_SUCCESS)
+        return status;
+    // Not wrapping the window: decimation uploads it from the phase offset on
+    rate->inputMem = firClBufferAcquire(env, CL_MEM_READ_ONLY, (rate->maxBlock + rate->tapsCount - 1) * sizeof(short), NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    rate->outputMem = firClBufferAcquire(env, CL_MEM_WRITE_ONLY, maxOutputs(rate) * sizeof(float), NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    rate->tapsMem = firClBufferAcquire(env, CL_MEM_READ_ONLY, tapsSize * sizeof(float), NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    return firClBufferWrite(env, rate->tapsMem, tapsSize * sizeof(float), rate->taps, NULL);
+}
+
+FirMultirate* firMultirateCreate(FirBackend backend, const FirClEnv* env, FirRateMode mode, size_t factor,
+                                 const float* taps, size_t tapsCount, size_t maxBlock, cl_int* status) {
+    cl_int result = CL_SUCCESS;
+    if(status == NULL)
+        status = &result;
+    *status = CL_INVALID_VALUE;
+    if(tapsCount == 0 || maxBlock == 0 || factor == 0)
+        return NULL;
+    *status = CL_OUT_OF_HOST_MEMORY;
+    FirMultirate* rate = (FirMultirate*)calloc(1, sizeof(FirMultirate));
+    if(rate == NULL)
+        return NULL;
+    rate->backend = backend;
+    rate->mode = mode;
+    rate->factor = factor;
+    rate->maxBlock = maxBlock;
+    const size_t tapsSize = mode == FIR_INTERPOLATE ? (tapsCount + factor - 1) / factor * factor : tapsCount;
+    rate->taps = (float*)malloc(sizeof(float)*tapsSize);
+    if(rate->taps == NULL){
+        firMultirateDestroy(rate);
+        return NULL;
+    }
+    if(mode == FIR_INTERPOLATE){
+        rate->tapsCount = firPolyphaseTaps(taps, tapsCount, factor, rate->taps);
+    }
+    else{
+        rate->tapsCount = tapsCount;
+        memcpy(rate->taps, taps, sizeof(float)*tapsCount);
+    }
+    rate->window = (short*)calloc(maxBlock + rate->tapsCount - 1, sizeof(short));
+    if(rate->window == NULL){
+        firMultirateDestroy(rate);
+        return NULL;
+    }
+
+    *status = backend == FIR_BACKEND_OPENCL ? setupOpenCL(rate, env, tapsSize) : CL_SUCCESS;
+    if(*status != CL_SUCCESS){
+        firMultirateDestroy(rate);
+        return NULL;
+    }
+    return rate;
+}
+
+void firMultirateDestroy(FirMultirate* rate) {
+    if(rate == NULL)
+        return;
+    if(rate->kernel)
+        clReleaseKernel(rate->kernel);
+    firClBufferRelease(rate->inputMem);
+    firClBufferRelease(rate->outputMem);
+    firClBufferRelease(rate->tapsMem);
+    free(rate->taps);
+    free(rate->window);
+    free(rate);
+}
+
+void firMultirateReset(FirMultirate* rate) {
+    memset(rate->window, 0, (rate->tapsCount - 1) * sizeof(short));
+    rate->phase = 0;
+}
+
+// Filter the window holding count new samples into *written outputs. The decimation
+// phase advances even when filtering fails (skip), keeping later blocks aligned.
+static cl_int filterWindow(FirMultirate* rate, size_t count, bool skip, float* output, size_t* written) {
+    const short* input = rate->window;
+    size_t inputCount = count + rate->tapsCount - 1;
+    size_t outputCount;
+    if(rate->mode == FIR_INTERPOLATE){
+        outputCount = count * rate->factor;
+    }
+    else{
+        // Kept outputs at window offsets phase, phase+factor, ... below count
+        outputCount = rate->phase < count ? (count - rate->phase + rate->factor - 1) / rate->factor : 0;
+        input += rate->phase;
+        inputCount -= rate->phase < count ? rate->phase : count;
+        rate->phase = rate->phase + outputCount * rate->factor - count;
+    }
+    *written = outputCount;
+    if(outputCount == 0 || skip)
+        return CL_SUCCESS;
+    if(rate->backend == FIR_BACKEND_CPU){
+        if(rate->mode == FIR_INTERPOLATE)
+            firInterpolate(input, count, rate->taps, rate->tapsCount, rate->factor, output);
+        else
+            firDecimate(input, outputCount, rate->taps, rate->tapsCount, rate->factor, output);
+        return CL_SUCCESS;
+    }
+    cl_int status;
+    status = firClBufferWrite(&rate->env, rate->inputMem, inputCount * sizeof(short), input, NULL);
+    if(status != CL_SUCCESS)
+        return status;
+    if(rate->mode == FIR_INTERPOLATE)
+        status = firClEnqueueInterpolate(&rate->env, rate->kernel, rate->inputMem, rate->outputMem, rate->tapsMem,
+                                         (cl_uint)rate->tapsCount, (cl_uint)rate->factor, (cl_uint)count, NULL);
+    else
+        status = firClEnqueueDecimate(&rate->env, rate->kernel, rate->inputMem, rate->outputMem, rate->tapsMem,
+                                      (cl_uint)rate->tapsCount, (cl_uint)rate->factor, (cl_uint)outputCount, NULL);
+    if(status != CL_SUCCESS)
+        return status;
+    return firClBufferRead(&rate->env, rate->outputMem, outputCount * sizeof(float), output, NULL);
+}
+
+cl_int firMultirateProcess(FirMultirate* rate, const short* block, size_t count, float* output, size_t* written) {
+    const size_t history = rate->tapsCount - 1;
+    cl_int status = CL_SUCCESS;
+    *written = 0;
+    while(count > 0){
+        size_t chunk = count < rate->maxBlock ? count : rate->maxBlock;
+        memcpy(rate->window + history, block, chunk * sizeof(short));
+        size_t outputs;
+        // After a failure the rest only advances the history and phase
+        const cl_int chunkStatus = filterWindow(rate, chunk, status != CL_SUCCESS, output + *written, &outputs);
+        if(status == CL_SUCCESS)
+            status = chunkStatus;
+        *written += outputs;
+        // The newest tapsCount-1 samples become the history of the next chunk
+        memmove(rate->window, rate->window + chunk, history * sizeof(short));
+        block += chunk;
+        count -= chunk;
+    }
+    return status;
+}
@@ -0,0 +1,48 @@
+#ifndef FIR_MULTIRATE_H
+#define FIR_MULTIRATE_H
+#include <stddef.h>
+#include "fir_cl.h"
+#include "fir_stream.h"
+
+typedef enum {
+    FIR_DECIMATE = 0,   // keep every factor-th output, computing only those
+    FIR_INTERPOLATE     // insert factor-1 zeros after every sample, never multiplying them
+} FirRateMode;
+
+// Causal multirate streaming filter, the rate-changing counterpart of FirStream.
+// Decimation yields output[k] = y[k*factor] with y the FirStream output for the same taps,
+// counted from the first sample after create/reset. Interpolation yields the FirStream
+// output of the zero-stuffed signal (sample m at position m*factor); scale the taps by
+// factor for unity passband gain. Both keep their history and phase across blocks.
+typedef struct FirMultirate FirMultirate;
+
+// env is only used (and must stay alive) for FIR_BACKEND_OPENCL.
+// maxBlock is the most input samples handled per launch; longer blocks are split internally.
+// NULL on failure, with the reason in status (may be NULL).
+FirMultirate* firMultirateCreate(FirBackend backend, const FirClEnv* env, FirRateMode mode, size_t factor,
+                                 const float* taps, size_t tapsCount, size_t maxBlock, cl_int* status);
+void firMultirateDestroy(FirMultirate* rate);
+void firMultirateReset(FirMultirate* rate);
+// Filter count new input samples; *written is how many outputs were produced: count*factor
+// when interpolating, at most count/factor + 1 when decimating. On an OpenCL error the
+// outputs from the failing chunk on are not valid, but *written, the history and the
+// phase still cover every sample given.
+cl_int firMultirateProcess(FirMultirate* rate, const short* block, size_t count, float* output, size_t* written);
+
+// One-shot CPU kernels. Decimation: output[k] = sum(input[k*factor+j] * taps[j]), input holds
+// (outputCount-1)*factor + tapsCount samples. Interpolation by polyphase components: taps is
+// factor rows of phaseTapsCount taps and output[m*factor+r] = sum(input[m+q] * taps[r*phaseTapsCount+q])
+// for m < inputCount, input holding inputCount + phaseTapsCount - 1 samples.
+void firDecimate(const short* input, size_t outputCount, const float* taps, size_t tapsCount,
+                 size_t factor, float* output);
+void firInterpolate(const short* input, size_t inputCount, const float* taps, size_t phaseTapsCount,
+                    size_t factor, float* output);
+// Polyphase components of taps for firInterpolate: factor rows of (tapsCount+factor-1)/factor
+size_t firPolyphaseTaps(const float* taps, size_t tapsCount, size_t factor, float* phaseTaps);
+
+// OpenCL counterparts of firDecimate/firInterpolate (FirDecimate and FirInterpolate in kernel.cl)
+cl_int firClEnqueueDecimate(const FirClEnv* env, cl_kernel kernel, cl_mem input, cl_mem output, cl_mem taps,
+                            cl_uint tapsCount, cl_uint factor, cl_uint outputCount, cl_event* event);
+cl_int firClEnqueueInterpolate(const FirClEnv* env, cl_kernel kernel, cl_mem input, cl_mem output, cl_mem phaseTaps,
+                               cl_uint phaseTapsCount, cl_uint factor, cl_uint inputCount, cl_event* event);
+#endif // FIR_MULTIRATE_H
@@ -0,0 +1,231 @@
+#include "fir_pipeline.h"
+#include "fir_trace.h"
+#include "fir_tune.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+// Device buffers of one chunk in flight, and the last commands that used them
+typedef struct {
+    cl_mem input;
+    cl_mem output;
+    cl_event filtered;  // kernel done: input may be overwritten
+    cl_event read;      // readback done: output may be overwritten
+} FirPipelineSlot;
+
+typedef struct {
+    FirPipeline* pipeline;
+    FirPipelineDone done;
+    void* user;
+    size_t chunk;
+    const float* output;
+    size_t count;
+} FirPipelineChunk;
+
+struct FirPipeline {
+    FirClEnv env;
+    // Stage queues: in-order each, ordered against each other only through events
+    cl_command_queue upload;
+    cl_command_queue compute;
+    cl_command_queue download;
+    FirClFilter filter;
+    cl_mem taps;
+    size_t tapsCount;
+    size_t chunkSize;
+    unsigned depth;
+    unsigned next;
+    FirPipelineSlot* slots;
+    // Chunks whose callback has not run yet
+    size_t pending;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+};
+
+static cl_int setupPipeline(FirPipeline* pipeline, const FirClEnv* env, const float* taps) {
+    cl_int status;
+    const size_t tapsCount = pipeline->tapsCount, chunkSize = pipeline->chunkSize;
+    pipeline->upload = clCreateCommandQueue(env->context, env->device, CL_QUEUE_PROFILING_ENABLE, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    pipeline->compute = clCreateCommandQueue(env->context, env->device, CL_QUEUE_PROFILING_ENABLE, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    pipeline->download = clCreateCommandQueue(env->context, env->device, CL_QUEUE_PROFILING_ENABLE, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    // firClEnqueueFilter launches on env.queue
+    pipeline->env.queue = pipeline->compute;
+
+    status = firClCreateTunedFilter(&pipeline->env, tapsCount, chunkSize, &pipeline->filter);
+    if(status != CL_SUCCESS)
+        return status;
+    pipeline->taps = clCreateBuffer(env->context, CL_MEM_READ_ONLY, tapsCount * sizeof(float), NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    status = clEnqueueWriteBuffer(pipeline->upload, pipeline->taps, CL_TRUE, 0, tapsCount * sizeof(float), taps, 0, NULL, NULL);
+    for(unsigned i = 0; i < pipeline->depth && status == CL_SUCCESS; i++){
+        pipeline->slots[i].input = clCreateBuffer(env->context, CL_MEM_READ_ONLY, (chunkSize + tapsCount - 1) * sizeof(short), NULL, &status);
+        if(status != CL_SUCCESS)
+            return status;
+        pipeline->slots[i].output = clCreateBuffer(env->context, CL_MEM_WRITE_ONLY, chunkSize * sizeof(float), NULL, &status);
+    }
+    return status;
+}
+
+FirPipeline* firPipelineCreate(const FirClEnv* env, const float* taps, size_t tapsCount,
+                               size_t chunkSize, unsigned depth, cl_int* status) {
+    cl_int result = CL_SUCCESS;
+    if(status == NULL)
+        status = &result;
+    if(tapsCount == 0 || chunkSize == 0){
+        *status = CL_INVALID_VALUE;
+        return NULL;
+    }
+    FirPipeline* pipeline = (FirPipeline*)calloc(1, sizeof(FirPipeline));
+    if(pipeline == NULL){
+        *status = CL_OUT_OF_HOST_MEMORY;
+        return NULL;
+    }
+    pipeline->depth = depth ? depth : FIR_PIPELINE_DEPTH;
+    pipeline->slots = (FirPipelineSlot*)calloc(pipeline->depth, sizeof(FirPipelineSlot));
+    if(pipeline->slots == NULL){
+        free(pipeline);
+        *status = CL_OUT_OF_HOST_MEMORY;
+        return NULL;
+    }
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->idle, NULL);
+    pipeline->env = *env;
+    pipeline->tapsCount = tapsCount;
+    pipeline->chunkSize = chunkSize;
+    *status = setupPipeline(pipeline, env, taps);
+    if(*status != CL_SUCCESS){
+        firPipelineDestroy(pipeline);
+        return NULL;
+    }
+    return pipeline;
+}
+
+void firPipelineDestroy(FirPipeline* pipeline) {
+    if(pipeline == NULL)
+        return;
+    if(pipeline->download)
+        firPipelineFinish(pipeline);
+    for(unsigned i = 0; i < pipeline->depth; i++){
+        FirPipelineSlot* slot = &pipeline->slots[i];
+        if(slot->filtered)
+            clReleaseEvent(slot->filtered);
+        if(slot->read)
+            clReleaseEvent(slot->read);
+        if(slot->input)
+            clReleaseMemObject(slot->input);
+        if(slot->output)
+            clReleaseMemObject(slot->output);
+    }
+    if(pipeline->taps)
+        clReleaseMemObject(pipeline->taps);
+    firClReleaseFilter(&pipeline->filter);
+    if(pipeline->upload)
+        clReleaseCommandQueue(pipeline->upload);
+    if(pipeline->compute)
+        clReleaseCommandQueue(pipeline->compute);
+    if(pipeline->download)
+        clReleaseCommandQueue(pipeline->download);
+    pthread_mutex_destroy(&pipeline->lock);
+    pthread_cond_destroy(&pipeline->idle);
+    free(pipeline->slots);
+    free(pipeline);
+}
+
+static void chunkDone(FirPipeline* pipeline) {
+    pthread_mutex_lock(&pipeline->lock);
+    if(--pipeline->pending == 0)
+        pthread_cond_broadcast(&pipeline->idle);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+static void CL_CALLBACK chunkRead(cl_event event, cl_int status, void* data) {
+    (void)event;
+    (void)status;
+    FirPipelineChunk* chunk = (FirPipelineChunk*)data;
+    FirPipeline* pipeline = chunk->pipeline;
+    if(chunk->done != NULL)
+        chunk->done(chunk->user, chunk->chunk, chunk->output, chunk->count);
+    free(chunk);
+    chunkDone(pipeline);
+}
+
+// Swap in a new event for a slot, dropping the one it replaces
+static void setEvent(cl_event* slot, cl_event event) {
+    if(*slot)
+        clReleaseEvent(*slot);
+    *slot = event;
+}
+
+cl_int firPipelineSubmit(FirPipeline* pipeline, const short* input, size_t outputCount, float* output,
+                         FirPipelineDone done, void* user) {
+    cl_int status = CL_SUCCESS;
+    for(size_t chunk = 0, pos = 0; pos < outputCount; chunk++, pos += pipeline->chunkSize){
+        const size_t count = outputCount - pos < pipeline->chunkSize ? outputCount - pos : pipeline->chunkSize;
+        FirPipelineSlot* slot = &pipeline->slots[pipeline->next];
+        pipeline->next = (pipeline->next + 1) % pipeline->depth;
+
+        // Upload once the kernel depth chunks back has finished reading this slot
+        cl_event uploaded, filtered, read;
+        FirTraceCall trace;
+        const size_t uploadSize = (count + pipeline->tapsCount - 1) * sizeof(short);
+        status = clEnqueueWriteBuffer(pipeline->upload, slot->input, CL_FALSE, 0, uploadSize, input + pos,
+                                      slot->filtered ? 1 : 0, slot->filtered ? &slot->filtered : NULL,
+                                      firTraceBegin(&trace, &uploaded));
+        firTraceEnd(&trace, &uploaded, FIR_TRACE_UPLOAD, "write", status, uploadSize, 0);
+        if(status != CL_SUCCESS)
+            break;
+        // Filter once uploaded and once the previous readback of this slot has drained its output
+        cl_event ready[2] = { uploaded, slot->read };
+        status = clEnqueueBarrierWithWaitList(pipeline->compute, slot->read ? 2 : 1, ready, NULL);
+        clReleaseEvent(uploaded);
+        if(status != CL_SUCCESS)
+            break;
+        status = firClEnqueueFilter(&pipeline->env, &pipeline->filter, slot->input, slot->output, pipeline->taps,
+                                    (cl_uint)pipeline->tapsCount, (cl_uint)count, &filtered);
+        if(status != CL_SUCCESS)
+            break;
+        setEvent(&slot->filtered, filtered);
+        status = clEnqueueReadBuffer(pipeline->download, slot->output, CL_FALSE, 0, count * sizeof(float), output + pos,
+                                     1, &slot->filtered, firTraceBegin(&trace, &read));
+        firTraceEnd(&trace, &read, FIR_TRACE_READBACK, "read", status, count * sizeof(float), 0);
+        if(status != CL_SUCCESS)
+            break;
+        setEvent(&slot->read, read);
+
+        FirPipelineChunk* data = (FirPipelineChunk*)malloc(sizeof(FirPipelineChunk));
+        if(data == NULL){
+            status = CL_OUT_OF_HOST_MEMORY;
+            break;
+        }
+        *data = (FirPipelineChunk){ pipeline, done, user, chunk, output + pos, count };
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->pending++;
+        pthread_mutex_unlock(&pipeline->lock);
+        status = clSetEventCallback(read, CL_COMPLETE, chunkRead, data);
+        if(status != CL_SUCCESS){
+            free(data);
+            chunkDone(pipeline);
+            break;
+        }
+    }
+    // Start all three queues now rather than at the next blocking call
+    clFlush(pipeline->upload);
+    clFlush(pipeline->compute);
+    clFlush(pipeline->download);
+    return status;
+}
+
+cl_int firPipelineFinish(FirPipeline* pipeline) {
+    cl_int status = clFinish(pipeline->download);
+    // clFinish does not wait for callbacks
+    pthread_mutex_lock(&pipeline->lock);
+    while(pipeline->pending > 0)
+        pthread_cond_wait(&pipeline->idle, &pipeline->lock);
+    pthread_mutex_unlock(&pipeline->lock);
+    return status;
+}
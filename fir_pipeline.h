@@ -0,0 +1,30 @@
+#ifndef FIR_PIPELINE_H
+#define FIR_PIPELINE_H
+#include <stddef.h>
+#include <CL/cl.h>
+#include "fir_cl.h"
+
+// Chunks in flight by default: one uploading, one filtering, one reading back
+#define FIR_PIPELINE_DEPTH 3
+
+// Called once per chunk when its output has landed in the caller's output array.
+// Runs on an OpenCL runtime thread: keep it short and do not enqueue from it.
+typedef void (*FirPipelineDone)(void* user, size_t chunk, const float* output, size_t count);
+
+typedef struct FirPipeline FirPipeline;
+
+// Splits long signals into chunkSize-output chunks and runs upload, FirFilter and
+// readback of different chunks concurrently on three queues of env's context, so
+// throughput approaches the slowest stage instead of the sum. depth 0 = default.
+// NULL on failure, with the reason in status (may be NULL).
+FirPipeline* firPipelineCreate(const FirClEnv* env, const float* taps, size_t tapsCount,
+                               size_t chunkSize, unsigned depth, cl_int* status);
+void firPipelineDestroy(FirPipeline* pipeline);
+
+// Enqueue outputCount outputs from input (outputCount + tapsCount - 1 samples) and return
+// without waiting; input and output must stay valid until firPipelineFinish
+cl_int firPipelineSubmit(FirPipeline* pipeline, const short* input, size_t outputCount, float* output,
+                         FirPipelineDone done, void* user);
+// Wait until every submitted chunk is read back and its callback has returned
+cl_int firPipelineFinish(FirPipeline* pipeline);
+#endif // FIR_PIPELINE_H
@@ -0,0 +1,270 @@
+#include "fir_plan.h"
+#include "cpu_simd.h"
+#include "fir_trace.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Outputs per vector in firTapPlanFilter
+#define FIR_PLAN_LANES 8
+
+typedef float FirPlanLanes __attribute__((vector_size(FIR_PLAN_LANES * sizeof(float))));
+typedef short FirPlanShorts __attribute__((vector_size(FIR_PLAN_LANES * sizeof(short))));
+
+struct FirTapPlan {
+    FirTapStructure structure;
+    size_t tapsCount;
+    float* taps;         // as given, for dense plans
+    size_t termsCount;
+    float* coeffs;
+    cl_uint* offsets;    // sample offset of each coefficient (the first of a folded pair)
+    float mirror;        // 0 sparse, +1 symmetric, -1 antisymmetric
+};
+
+FirTapPlan* firTapPlanCreate(const float* taps, size_t tapsCount) {
+    if(tapsCount == 0)
+        return NULL;
+    FirTapPlan* plan = (FirTapPlan*)calloc(1, sizeof(FirTapPlan));
+    if(plan == NULL)
+        return NULL;
+    plan->tapsCount = tapsCount;
+    plan->taps = (float*)malloc(sizeof(float) * tapsCount);
+    plan->coeffs = (float*)malloc(sizeof(float) * tapsCount);
+    plan->offsets = (cl_uint*)malloc(sizeof(cl_uint) * tapsCount);
+    if(plan->taps == NULL || plan->coeffs == NULL || plan->offsets == NULL){
+        firTapPlanDestroy(plan);
+        return NULL;
+    }
+    memcpy(plan->taps, taps, sizeof(float) * tapsCount);
+
+    const size_t half = tapsCount / 2;
+    bool symmetric = tapsCount > 1, antisymmetric = tapsCount > 1;
+    size_t nonzero = 0;
+    for(size_t k = 0; k < tapsCount; k++){
+        if(taps[k] != 0.0f)
+            nonzero++;
+        if(k < half){
+            symmetric &= taps[k] == taps[tapsCount - 1 - k];
+            antisymmetric &= taps[k] == -taps[tapsCount - 1 - k];
+        }
+    }
+    // The centre tap of an odd antisymmetric filter must be zero
+    if(tapsCount % 2 == 1 && taps[half] != 0.0f)
+        antisymmetric = false;
+
+    if(symmetric || antisymmetric){
+        plan->structure = symmetric ? FIR_TAPS_SYMMETRIC : FIR_TAPS_ANTISYMMETRIC;
+        plan->mirror = symmetric ? 1.0f : -1.0f;
+        for(size_t k = 0; k < half; k++){
+            if(taps[k] != 0.0f){
+                plan->coeffs[plan->termsCount] = taps[k];
+                plan->offsets[plan->termsCount++] = (cl_uint)k;
+            }
+        }
+        // Odd symmetric centre: folded with itself at half weight, which is exact
+        if(symmetric && tapsCount % 2 == 1 && taps[half] != 0.0f){
+            plan->coeffs[plan->termsCount] = taps[half] * 0.5f;
+            plan->offsets[plan->termsCount++] = (cl_uint)half;
+        }
+    }
+    else if(tapsCount - nonzero >= FIR_PLAN_SPARSE_ZEROS * tapsCount){
+        plan->structure = FIR_TAPS_SPARSE;
+        for(size_t k = 0; k < tapsCount; k++){
+            if(taps[k] != 0.0f){
+                plan->coeffs[plan->termsCount] = taps[k];
+                plan->offsets[plan->termsCount++] = (cl_uint)k;
+            }
+        }
+    }
+    else{
+        plan->structure = FIR_TAPS_DENSE;
+    }
+    return plan;
+}
+
+void firTapPlanDestroy(FirTapPlan* plan) {
+    if(plan == NULL)
+        return;
+    free(plan->taps);
+    free(plan->coeffs);
+    free(plan->offsets);
+    free(plan);
+}
+
+FirTapStructure firTapPlanStructure(const FirTapPlan* plan) {
+    return plan->structure;
+}
+
+const char* firTapStructureName(FirTapStructure structure) {
+    switch(structure){
+    case FIR_TAPS_SPARSE: return "sparse";
+    case FIR_TAPS_SYMMETRIC: return "symmetric";
+    case FIR_TAPS_ANTISYMMETRIC: return "antisymmetric";
+    default: return "dense";
+    }
+}
+
+size_t firTapPlanMultiplies(const FirTapPlan* plan) {
+    return plan->structure == FIR_TAPS_DENSE ? plan->tapsCount : plan->termsCount;
+}
+
+static inline __attribute__((always_inline))
+void loadLanes(FirPlanLanes* lanes, const short* samples) {
+    FirPlanShorts s;
+    memcpy(&s, samples, sizeof(s));
+    *lanes = __builtin_convertvector(s, FirPlanLanes);
+}
+
+// Outputs [0, outputCount) of a sparse or folded plan, FIR_PLAN_LANES at a time
+static inline __attribute__((always_inline))
+void planBody(const FirTapPlan* plan, const short* input, size_t outputCount, float* output) {
+    // Locals, so the stores to output cannot be assumed to change the plan
+    const size_t last = plan->tapsCount - 1;
+    const size_t termsCount = plan->termsCount;
+    const float* coeffs = plan->coeffs;
+    const cl_uint* offsets = plan->offsets;
+    const float mirror = plan->mirror;
+    const size_t vectorOutputs = outputCount - outputCount % FIR_PLAN_LANES;
+    for(size_t i = 0; i < vectorOutputs; i += FIR_PLAN_LANES){
+        FirPlanLanes acc = {0};
+        const short* x = input + i;
+        for(size_t t = 0; t < termsCount; t++){
+            FirPlanLanes a, b;
+            loadLanes(&a, x + offsets[t]);
+            if(mirror != 0.0f){
+                loadLanes(&b, x + last - offsets[t]);
+                a = mirror > 0.0f ? a + b : a - b;
+            }
+            acc += a * coeffs[t];
+        }
+        memcpy(output + i, &acc, sizeof(acc));
+    }
+    for(size_t i = vectorOutputs; i < outputCount; i++){
+        const short* x = input + i;
+        float sum = 0;
+        for(size_t t = 0; t < termsCount; t++){
+            float a = x[offsets[t]];
+            if(mirror != 0.0f)
+                a = mirror > 0.0f ? a + x[last - offsets[t]] : a - x[last - offsets[t]];
+            sum += a * coeffs[t];
+        }
+        output[i] = sum;
+    }
+}
+
+static void planGeneric(const FirTapPlan* plan, const short* input, size_t outputCount, float* output) {
+    planBody(plan, input, outputCount, output);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+static void planAvx2(const FirTapPlan* plan, const short* input, size_t outputCount, float* output) {
+    planBody(plan, input, outputCount, output);
+}
+#endif
+
+static void planFilter(const FirTapPlan* plan, const short* input, size_t outputCount, float* output) {
+#if defined(__x86_64__) || defined(__i386__)
+    if(firSimdIsa() >= FIR_ISA_AVX2){
+        planAvx2(plan, input, outputCount, output);
+        return;
+    }
+#endif
+    planGeneric(plan, input, outputCount, output);
+}
+
+typedef struct {
+    const FirTapPlan* plan;
+    const short* input;
+    float* output;
+    size_t outputCount;
+    size_t blockSize;
+} PlanJob;
+
+static void planBlock(void* ctx, size_t task, unsigned worker) {
+    (void)worker;
+    const PlanJob* job = (const PlanJob*)ctx;
+    const size_t first = task * job->blockSize;
+    size_t count = job->outputCount - first;
+    if(count > job->blockSize)
+        count = job->blockSize;
+    planFilter(job->plan, job->input + first, count, job->output + first);
+}
+
+void firTapPlanFilter(const FirTapPlan* plan, FirPool* pool, const short* input, size_t outputCount, float* output) {
+    if(plan->structure == FIR_TAPS_DENSE){
+        firPoolFilter(pool, input, outputCount, plan->taps, plan->tapsCount, output);
+        return;
+    }
+    // Blocks sized like firPoolFilter's
+    size_t blockSize = FIR_POOL_BLOCK_BYTES / (sizeof(float) + sizeof(short));
+    blockSize = blockSize > plan->tapsCount ? blockSize - plan->tapsCount : 64;
+    blockSize = (blockSize + 63) & ~(size_t)63;
+    const uint64_t traceStart = firTraceStart();
+    if(pool == NULL || outputCount <= blockSize){
+        planFilter(plan, input, outputCount, output);
+    }
+    else{
+        PlanJob job = { plan, input, output, outputCount, blockSize };
+        firPoolRun(pool, (outputCount + blockSize - 1) / blockSize, planBlock, &job);
+    }
+    firTraceCpu("firTapPlanFilter", traceStart, outputCount);
+}
+
+cl_int firClTapPlanCreate(const FirClEnv* env, const FirTapPlan* plan, FirClTapPlan* clPlan) {
+    cl_int status;
+    memset(clPlan, 0, sizeof(*clPlan));
+    if(plan->structure == FIR_TAPS_DENSE || plan->tapsCount > firClMaxTiledTapsSized(env, 1, FIR_CL_LOCAL_SIZE))
+        return CL_INVALID_VALUE;
+    clPlan->kernel = clCreateKernel(env->program, "FirFilterPlanned", &status);
+    if(status != CL_SUCCESS)
+        return status;
+    // An empty list (all-zero taps) still needs valid buffers
+    const size_t terms = plan->termsCount ? plan->termsCount : 1;
+    clPlan->coeffs = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, terms * sizeof(cl_float), plan->coeffs, &status);
+    if(status != CL_SUCCESS){
+        firClTapPlanRelease(clPlan);
+        return status;
+    }
+    clPlan->offsets = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, terms * sizeof(cl_uint), plan->offsets, &status);
+    if(status != CL_SUCCESS)
+        firClTapPlanRelease(clPlan);
+    return status;
+}
+
+void firClTapPlanRelease(FirClTapPlan* clPlan) {
+    if(clPlan->kernel)
+        clReleaseKernel(clPlan->kernel);
+    if(clPlan->coeffs)
+        clReleaseMemObject(clPlan->coeffs);
+    if(clPlan->offsets)
+        clReleaseMemObject(clPlan->offsets);
+    memset(clPlan, 0, sizeof(*clPlan));
+}
+
+cl_int firClEnqueueTapPlan(const FirClEnv* env, const FirTapPlan* plan, const FirClTapPlan* clPlan,
+                           cl_mem input, cl_mem output, cl_uint outputCount, cl_event* event) {
+    cl_int status;
+    cl_kernel kernel = clPlan->kernel;
+    const cl_uint termsCount = (cl_uint)plan->termsCount;
+    const cl_float mirror = plan->mirror;
+    const cl_uint tapsCount = (cl_uint)plan->tapsCount;
+    status  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+    status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
+    status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &clPlan->coeffs);
+    status |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &clPlan->offsets);
+    status |= clSetKernelArg(kernel, 4, sizeof(cl_uint), &termsCount);
+    status |= clSetKernelArg(kernel, 5, sizeof(cl_float), &mirror);
+    status |= clSetKernelArg(kernel, 6, sizeof(cl_uint), &tapsCount);
+    status |= clSetKernelArg(kernel, 7, sizeof(cl_uint), &outputCount);
+    status |= clSetKernelArg(kernel, 8, (FIR_CL_LOCAL_SIZE + tapsCount - 1) * sizeof(cl_float), NULL);
+    if(status != CL_SUCCESS || outputCount == 0)
+        return status;
+    size_t local_work_size[1] = {FIR_CL_LOCAL_SIZE};
+    size_t global_work_size[1] = {((size_t)outputCount + FIR_CL_LOCAL_SIZE - 1) / FIR_CL_LOCAL_SIZE * FIR_CL_LOCAL_SIZE};
+    FirTraceCall trace;
+    status = clEnqueueNDRangeKernel(env->queue, kernel, 1, NULL, global_work_size, local_work_size, 0, NULL,
+                                    firTraceBegin(&trace, event));
+    firTraceEnd(&trace, event, FIR_TRACE_KERNEL, "FirFilterPlanned", status, 0, outputCount);
+    return status;
+}
@@ -0,0 +1,46 @@
+#ifndef FIR_PLAN_H
+#define FIR_PLAN_H
+#include <stddef.h>
+#include "cpu_pool.h"
+#include "fir_cl.h"
+
+// Tap structures the planner exploits
+typedef enum {
+    FIR_TAPS_DENSE = 0,      // no structure worth using: the regular engines run
+    FIR_TAPS_SPARSE,         // enough zero taps to only visit the nonzero ones
+    FIR_TAPS_SYMMETRIC,      // taps[k] == taps[n-1-k]: mirrored samples are pre-added
+    FIR_TAPS_ANTISYMMETRIC   // taps[k] == -taps[n-1-k]: mirrored samples are pre-subtracted
+} FirTapStructure;
+
+// Zero taps, as a share of all taps, from which a non-symmetric filter goes sparse
+#define FIR_PLAN_SPARSE_ZEROS 0.25
+
+// Filter plan from an inspection of the taps at creation. The folded structures also skip
+// zero pairs, so a half-band filter costs about a quarter of the multiplies. Pre-adding
+// int16 samples is exact in float, so results stay within FIR_SIMD_REL_TOLERANCE of firSimd.
+typedef struct FirTapPlan FirTapPlan;
+
+FirTapPlan* firTapPlanCreate(const float* taps, size_t tapsCount);
+void firTapPlanDestroy(FirTapPlan* plan);
+FirTapStructure firTapPlanStructure(const FirTapPlan* plan);
+const char* firTapStructureName(FirTapStructure structure);
+// Multiplies per output (tapsCount for dense plans)
+size_t firTapPlanMultiplies(const FirTapPlan* plan);
+// Same contract as firPoolFilter (pool may be NULL); dense plans run firPoolFilter itself
+void firTapPlanFilter(const FirTapPlan* plan, FirPool* pool, const short* input, size_t outputCount, float* output);
+
+// FirFilterPlanned with the plan's coefficient and offset lists on the device
+typedef struct {
+    cl_kernel kernel;
+    cl_mem coeffs;
+    cl_mem offsets;
+} FirClTapPlan;
+
+// CL_INVALID_VALUE for dense plans and for tap counts whose tile does not fit local memory;
+// callers then keep to the regular kernels
+cl_int firClTapPlanCreate(const FirClEnv* env, const FirTapPlan* plan, FirClTapPlan* clPlan);
+void firClTapPlanRelease(FirClTapPlan* clPlan);
+// Enqueue like firClEnqueueFilter: input holds outputCount + tapsCount - 1 samples
+cl_int firClEnqueueTapPlan(const FirClEnv* env, const FirTapPlan* plan, const FirClTapPlan* clPlan,
+                           cl_mem input, cl_mem output, cl_uint outputCount, cl_event* event);
+#endif // FIR_PLAN_H
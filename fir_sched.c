@@ -0,0 +1,328 @@
+#include "fir_sched.h"
+#include "cpu_simd.h"
+#include "fir_cache.h"
+#include "fir_cl.h"
+#include "fir_trace.h"
+#include "fir_tune.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+typedef struct {
+    char name[160];
+    bool native;
+    FirClEnv env;
+    FirClFilter filter;
+    cl_mem input;
+    cl_mem output;
+    cl_mem taps;
+    double rate;   // outputs per second, 0 until measured
+    size_t share;  // outputs of the last firSchedFilter
+} FirSchedDevice;
+
+struct FirScheduler {
+    FirSchedDevice* devices;
+    size_t deviceCount;
+    float* taps;
+    size_t tapsCount;
+    FirPool* pool;
+    // State of the running firSchedFilter, guarded by lock
+    pthread_mutex_t lock;
+    const short* input;
+    float* output;
+    size_t outputCount;
+    size_t next;
+    cl_int status;
+};
+
+typedef struct {
+    FirScheduler* scheduler;
+    FirSchedDevice* device;
+} FirSchedWorker;
+
+static double nowSeconds() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec + now.tv_usec / 1e6;
+}
+
+static void releaseDevice(FirSchedDevice* device) {
+    if(device->native)
+        return;
+    firClReleaseFilter(&device->filter);
+    if(device->input)
+        clReleaseMemObject(device->input);
+    if(device->output)
+        clReleaseMemObject(device->output);
+    if(device->taps)
+        clReleaseMemObject(device->taps);
+    // Tuned variants built for this context would otherwise keep it alive
+    if(device->env.context)
+        firClReleaseContextVariants(device->env.context);
+    if(device->env.program)
+        clReleaseProgram(device->env.program);
+    if(device->env.queue)
+        clReleaseCommandQueue(device->env.queue);
+    if(device->env.context)
+        clReleaseContext(device->env.context);
+}
+
+// Own context, queue, program, tuned kernel and chunk buffers for one device
+static cl_int setupDevice(FirScheduler* scheduler, cl_device_id id, const char* source, FirSchedDevice* device) {
+    cl_int status;
+    char name[128] = "";
+    clGetDeviceInfo(id, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    snprintf(device->name, sizeof(device->name), "%s", name);
+    device->env.device = id;
+    device->env.source = source;
+    device->env.context = clCreateContext(NULL, 1, &id, NULL, NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    device->env.queue = clCreateCommandQueue(device->env.context, id, CL_QUEUE_PROFILING_ENABLE, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    device->env.program = firClBuildCached(device->env.context, id, source, NULL, NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    status = firClCreateTunedFilter(&device->env, scheduler->tapsCount, FIR_SCHED_MAX_CHUNK, &device->filter);
+    if(status != CL_SUCCESS)
+        return status;
+    device->input = clCreateBuffer(device->env.context, CL_MEM_READ_ONLY,
+                                   (FIR_SCHED_MAX_CHUNK + scheduler->tapsCount - 1) * sizeof(short), NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    device->output = clCreateBuffer(device->env.context, CL_MEM_WRITE_ONLY, FIR_SCHED_MAX_CHUNK * sizeof(float), NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    device->taps = clCreateBuffer(device->env.context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  scheduler->tapsCount * sizeof(float), scheduler->taps, &status);
+    return status;
+}
+
+// skipCpu leaves out OpenCL CPU devices (PoCL and the like): they would share the cores
+// with the native engine, so neither side's measured rate would mean anything
+static void addOpenCLDevices(FirScheduler* scheduler, const char* source, bool skipCpu) {
+    cl_uint platformCount = 0;
+    if(clGetPlatformIDs(0, NULL, &platformCount) != CL_SUCCESS || platformCount == 0)
+        return;
+    cl_platform_id* platforms = (cl_platform_id*)malloc(sizeof(cl_platform_id) * platformCount);
+    if(platforms == NULL || clGetPlatformIDs(platformCount, platforms, NULL) != CL_SUCCESS){
+        free(platforms);
+        return;
+    }
+    for(cl_uint p = 0; p < platformCount; p++){
+        cl_uint idCount = 0;
+        if(clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, 0, NULL, &idCount) != CL_SUCCESS || idCount == 0)
+            continue;
+        cl_device_id* ids = (cl_device_id*)malloc(sizeof(cl_device_id) * idCount);
+        FirSchedDevice* grown = (FirSchedDevice*)realloc(scheduler->devices, sizeof(FirSchedDevice) * (scheduler->deviceCount + idCount));
+        if(ids == NULL || grown == NULL){
+            free(ids);
+            if(grown != NULL)
+                scheduler->devices = grown;
+            break;
+        }
+        scheduler->devices = grown;
+        clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, idCount, ids, NULL);
+        for(cl_uint d = 0; d < idCount; d++){
+            cl_device_type type = 0;
+            clGetDeviceInfo(ids[d], CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+            if(skipCpu && (type & CL_DEVICE_TYPE_CPU) != 0)
+                continue;
+            FirSchedDevice* device = &scheduler->devices[scheduler->deviceCount];
+            memset(device, 0, sizeof(FirSchedDevice));
+            cl_int status = setupDevice(scheduler, ids[d], source, device);
+            if(status != CL_SUCCESS){
+                printf("Scheduler skips %s (Error = %d)\n", device->name, status);
+                releaseDevice(device);
+                continue;
+            }
+            scheduler->deviceCount++;
+        }
+        free(ids);
+    }
+    free(platforms);
+}
+
+FirScheduler* firSchedCreate(const float* taps, size_t tapsCount, const char* source,
+                             unsigned executors, FirPool* pool) {
+    if(tapsCount == 0)
+        return NULL;
+    FirScheduler* scheduler = (FirScheduler*)calloc(1, sizeof(FirScheduler));
+    if(scheduler == NULL)
+        return NULL;
+    scheduler->taps = (float*)malloc(sizeof(float) * tapsCount);
+    if(scheduler->taps == NULL){
+        free(scheduler);
+        return NULL;
+    }
+    memcpy(scheduler->taps, taps, sizeof(float) * tapsCount);
+    scheduler->tapsCount = tapsCount;
+    scheduler->pool = pool;
+    pthread_mutex_init(&scheduler->lock, NULL);
+
+    if((executors & FIR_SCHED_OPENCL) && source != NULL)
+        addOpenCLDevices(scheduler, source, (executors & FIR_SCHED_NATIVE_CPU) != 0);
+    if(executors & FIR_SCHED_NATIVE_CPU){
+        FirSchedDevice* grown = (FirSchedDevice*)realloc(scheduler->devices, sizeof(FirSchedDevice) * (scheduler->deviceCount + 1));
+        if(grown != NULL){
+            scheduler->devices = grown;
+            FirSchedDevice* device = &scheduler->devices[scheduler->deviceCount++];
+            memset(device, 0, sizeof(FirSchedDevice));
+            device->native = true;
+            snprintf(device->name, sizeof(device->name), "CPU %s x%u", firSimdIsaName(firSimdIsa()),
+                     pool != NULL ? firPoolThreads(pool) : 1);
+        }
+    }
+    if(scheduler->deviceCount == 0){
+        firSchedDestroy(scheduler);
+        return NULL;
+    }
+    return scheduler;
+}
+
+void firSchedDestroy(FirScheduler* scheduler) {
+    if(scheduler == NULL)
+        return;
+    for(size_t i = 0; i < scheduler->deviceCount; i++)
+        releaseDevice(&scheduler->devices[i]);
+    pthread_mutex_destroy(&scheduler->lock);
+    free(scheduler->devices);
+    free(scheduler->taps);
+    free(scheduler);
+}
+
+// Next chunk for device, or 0 when the input is used up. Caller holds the lock.
+static size_t claimChunk(FirScheduler* scheduler, FirSchedDevice* device, size_t* start) {
+    const size_t remaining = scheduler->outputCount - scheduler->next;
+    if(remaining == 0 || scheduler->status != CL_SUCCESS)
+        return 0;
+    size_t count = FIR_SCHED_PROBE;
+    if(device->rate > 0){
+        double totalRate = 0;
+        for(size_t i = 0; i < scheduler->deviceCount; i++)
+            totalRate += scheduler->devices[i].rate > 0 ? scheduler->devices[i].rate : device->rate;
+        // Enough for FIR_SCHED_CHUNK_MS, but never more than half of this device's fair
+        // share of what is left, so the slowest device does not finish last by a chunk
+        const double timed = device->rate * FIR_SCHED_CHUNK_MS / 1000.0;
+        const double fair = remaining * (device->rate / totalRate) / 2.0;
+        count = (size_t)(timed < fair ? timed : fair);
+    }
+    if(count < FIR_SCHED_MIN_CHUNK)
+        count = FIR_SCHED_MIN_CHUNK;
+    if(count > FIR_SCHED_MAX_CHUNK)
+        count = FIR_SCHED_MAX_CHUNK;
+    if(count > remaining)
+        count = remaining;
+    *start = scheduler->next;
+    scheduler->next += count;
+    return count;
+}
+
+static cl_int runChunk(FirScheduler* scheduler, FirSchedDevice* device, size_t start, size_t count) {
+    const short* input = scheduler->input + start;
+    float* output = scheduler->output + start;
+    if(device->native){
+        firPoolFilter(scheduler->pool, input, count, scheduler->taps, scheduler->tapsCount, output);
+        return CL_SUCCESS;
+    }
+    // Each chunk carries its own tapsCount-1 halo samples
+    FirTraceCall trace;
+    const size_t uploadSize = (count + scheduler->tapsCount - 1) * sizeof(short);
+    cl_int status = clEnqueueWriteBuffer(device->env.queue, device->input, CL_FALSE, 0, uploadSize, input, 0, NULL,
+                                         firTraceBegin(&trace, NULL));
+    firTraceEnd(&trace, NULL, FIR_TRACE_UPLOAD, "write", status, uploadSize, 0);
+    if(status != CL_SUCCESS)
+        return status;
+    status = firClEnqueueFilter(&device->env, &device->filter, device->input, device->output, device->taps,
+                                (cl_uint)scheduler->tapsCount, (cl_uint)count, NULL);
+    if(status != CL_SUCCESS)
+        return status;
+    status = clEnqueueReadBuffer(device->env.queue, device->output, CL_TRUE, 0, count * sizeof(float), output, 0, NULL,
+                                 firTraceBegin(&trace, NULL));
+    firTraceEnd(&trace, NULL, FIR_TRACE_READBACK, "read", status, count * sizeof(float), 0);
+    return status;
+}
+
+static void* schedWorker(void* data) {
+    FirSchedWorker* worker = (FirSchedWorker*)data;
+    FirScheduler* scheduler = worker->scheduler;
+    FirSchedDevice* device = worker->device;
+    for(;;){
+        size_t start = 0;
+        pthread_mutex_lock(&scheduler->lock);
+        const size_t count = claimChunk(scheduler, device, &start);
+        pthread_mutex_unlock(&scheduler->lock);
+        if(count == 0)
+            break;
+        const double begin = nowSeconds();
+        cl_int status = runChunk(scheduler, device, start, count);
+        const double elapsed = nowSeconds() - begin;
+        pthread_mutex_lock(&scheduler->lock);
+        if(status != CL_SUCCESS){
+            if(scheduler->status == CL_SUCCESS)
+                scheduler->status = status;
+        }
+        else if(elapsed > 0){
+            // Moving average, so a device that slows down gets smaller chunks
+            const double rate = count / elapsed;
+            device->rate = device->rate > 0 ? 0.5 * device->rate + 0.5 * rate : rate;
+            device->share += count;
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+    return NULL;
+}
+
+cl_int firSchedFilter(FirScheduler* scheduler, const short* input, size_t outputCount, float* output) {
+    if(scheduler->deviceCount == 0)
+        return CL_DEVICE_NOT_FOUND;
+    scheduler->input = input;
+    scheduler->output = output;
+    scheduler->outputCount = outputCount;
+    scheduler->next = 0;
+    scheduler->status = CL_SUCCESS;
+    for(size_t i = 0; i < scheduler->deviceCount; i++)
+        scheduler->devices[i].share = 0;
+
+    FirSchedWorker* workers = (FirSchedWorker*)malloc(sizeof(FirSchedWorker) * scheduler->deviceCount);
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * scheduler->deviceCount);
+    if(workers == NULL || threads == NULL){
+        free(workers);
+        free(threads);
+        return CL_OUT_OF_HOST_MEMORY;
+    }
+    size_t started = 0;
+    for(size_t i = 0; i < scheduler->deviceCount; i++){
+        workers[i].scheduler = scheduler;
+        workers[i].device = &scheduler->devices[i];
+        if(pthread_create(&threads[started], NULL, schedWorker, &workers[i]) == 0)
+            started++;
+    }
+    // Without any thread the caller does the work itself
+    if(started == 0)
+        schedWorker(&workers[0]);
+    for(size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(workers);
+    free(threads);
+    return scheduler->status;
+}
+
+size_t firSchedDevices(const FirScheduler* scheduler) {
+    return scheduler->deviceCount;
+}
+
+const char* firSchedDeviceName(const FirScheduler* scheduler, size_t index) {
+    return scheduler->devices[index].name;
+}
+
+double firSchedRate(const FirScheduler* scheduler, size_t index) {
+    return scheduler->devices[index].rate;
+}
+
+size_t firSchedShare(const FirScheduler* scheduler, size_t index) {
+    return scheduler->devices[index].share;
+}
@@ -0,0 +1,42 @@
+#ifndef FIR_SCHED_H
+#define FIR_SCHED_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <CL/cl.h>
+#include "cpu_pool.h"
+
+// Which executors firSchedCreate sets up
+#define FIR_SCHED_OPENCL 1u      // every device of every OpenCL platform (GPUs, PoCL, ...)
+#define FIR_SCHED_NATIVE_CPU 2u  // the SIMD CPU engine on a FirPool; OpenCL CPU devices are then
+                                 // left out, as they would compete for the same cores
+#define FIR_SCHED_ALL (FIR_SCHED_OPENCL | FIR_SCHED_NATIVE_CPU)
+
+// Chunk sizing: the first chunk a device gets is a probe of FIR_SCHED_PROBE outputs; later
+// ones last about FIR_SCHED_CHUNK_MS at the device's measured rate, shrinking towards the
+// end so all devices finish together. Device buffers hold FIR_SCHED_MAX_CHUNK outputs.
+#define FIR_SCHED_PROBE (1 << 16)
+#define FIR_SCHED_MIN_CHUNK (1 << 12)
+#define FIR_SCHED_MAX_CHUNK (1 << 22)
+#define FIR_SCHED_CHUNK_MS 20.0
+
+typedef struct FirScheduler FirScheduler;
+
+// source is the kernel.cl text, built per device through the binary cache. OpenCL
+// devices that fail to set up are skipped with a message; NULL if nothing is left.
+// pool (may be NULL) runs the native CPU engine and must outlive the scheduler.
+FirScheduler* firSchedCreate(const float* taps, size_t tapsCount, const char* source,
+                             unsigned executors, FirPool* pool);
+void firSchedDestroy(FirScheduler* scheduler);
+
+// Filter outputCount outputs (input holds outputCount + tapsCount - 1 samples), split into
+// chunks that overlap by tapsCount-1 input samples and handed out to whichever executor
+// is free. Returns the first error any executor hit (CL_DEVICE_NOT_FOUND without any
+// executor), CL_SUCCESS otherwise.
+cl_int firSchedFilter(FirScheduler* scheduler, const short* input, size_t outputCount, float* output);
+
+size_t firSchedDevices(const FirScheduler* scheduler);
+const char* firSchedDeviceName(const FirScheduler* scheduler, size_t index);
+// Measured rate in outputs per second (0 before the first run) and outputs done last call
+double firSchedRate(const FirScheduler* scheduler, size_t index);
+size_t firSchedShare(const FirScheduler* scheduler, size_t index);
+#endif // FIR_SCHED_H
@@ -0,0 +1,185 @@
+#include "fir_stream.h"
+#include "fir_buffer.h"
+#include "fir_tune.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct FirStream {
+    FirBackend backend;
+    size_t tapsCount;
+    size_t maxBlock;
+    float* taps;
+    // tapsCount-1 samples of history followed by up to maxBlock new samples; page aligned
+    // so zero-copy devices read it in place
+    short* window;
+    FirPool* pool;
+    FirFftPlan* fft;
+    FirTapPlan* plan;      // direct engine: folded/sparse taps when they have structure
+
+    FirClEnv env;
+    FirClFilter filter;
+    FirClTapPlan clPlan;   // kernel is NULL when the plan is dense or does not fit
+    cl_mem inputMem;
+    cl_mem outputMem;
+    cl_mem tapsMem;
+    FirFftCl* fftCl;
+};
+
+static cl_int setupOpenCL(FirStream* stream, FirEngine engine, const FirClEnv* env) {
+    cl_int status = CL_SUCCESS;
+    const size_t tapsCount = stream->tapsCount, maxBlock = stream->maxBlock;
+    stream->env = *env;
+    if(stream->plan == NULL || firClTapPlanCreate(env, stream->plan, &stream->clPlan) != CL_SUCCESS){
+        status = firClCreateTunedFilter(env, tapsCount, maxBlock, &stream->filter);
+        if(status != CL_SUCCESS)
+            return status;
+    }
+    stream->inputMem = firClBufferAcquire(env, CL_MEM_READ_ONLY, (maxBlock + tapsCount - 1) * sizeof(short), stream->window, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    stream->outputMem = firClBufferAcquire(env, CL_MEM_WRITE_ONLY, maxBlock * sizeof(float), NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    stream->tapsMem = firClBufferAcquire(env, CL_MEM_READ_ONLY, tapsCount * sizeof(float), NULL, &status);
+    if(status != CL_SUCCESS)
+        return status;
+    status = firClBufferWrite(env, stream->tapsMem, tapsCount * sizeof(float), stream->taps, NULL);
+    if(status != CL_SUCCESS)
+        return status;
+    if(engine == FIR_ENGINE_FFT){
+        stream->fftCl = firFftClCreate(env, stream->taps, tapsCount, maxBlock, &status);
+        if(stream->fftCl == NULL)
+            return status;
+    }
+    return CL_SUCCESS;
+}
+
+FirStream* firStreamCreate(FirBackend backend, FirEngine engine, const FirClEnv* env,
+                           const float* taps, size_t tapsCount, size_t maxBlock, cl_int* status) {
+    cl_int result = CL_SUCCESS;
+    if(status == NULL)
+        status = &result;
+    *status = CL_INVALID_VALUE;
+    if(tapsCount == 0 || maxBlock == 0)
+        return NULL;
+    *status = CL_OUT_OF_HOST_MEMORY;
+    FirStream* stream = (FirStream*)calloc(1, sizeof(FirStream));
+    if(stream == NULL)
+        return NULL;
+    stream->backend = backend;
+    stream->tapsCount = tapsCount;
+    stream->maxBlock = maxBlock;
+    stream->taps = (float*)malloc(sizeof(float)*tapsCount);
+    stream->window = (short*)firClHostAlloc((maxBlock + tapsCount - 1) * sizeof(short));
+    if(stream->taps == NULL || stream->window == NULL){
+        firStreamDestroy(stream);
+        return NULL;
+    }
+    memset(stream->window, 0, (maxBlock + tapsCount - 1) * sizeof(short));
+    memcpy(stream->taps, taps, sizeof(float)*tapsCount);
+
+    if(engine == FIR_ENGINE_AUTO){
+        size_t crossover = 0;
+        if(backend == FIR_BACKEND_OPENCL){
+            *status = firFftClCrossover(env, &crossover);
+            if(*status != CL_SUCCESS){
+                firStreamDestroy(stream);
+                return NULL;
+            }
+            *status = CL_OUT_OF_HOST_MEMORY;
+        }
+        else{
+            crossover = firFftCrossover();
+        }
+        engine = tapsCount >= crossover ? FIR_ENGINE_FFT : FIR_ENGINE_DIRECT;
+    }
+    if(engine == FIR_ENGINE_DIRECT){
+        stream->plan = firTapPlanCreate(taps, tapsCount);
+        if(stream->plan == NULL){
+            firStreamDestroy(stream);
+            return NULL;
+        }
+    }
+    if(engine == FIR_ENGINE_FFT && backend == FIR_BACKEND_CPU){
+        stream->fft = firFftCreate(taps, tapsCount);
+        if(stream->fft == NULL){
+            firStreamDestroy(stream);
+            return NULL;
+        }
+    }
+
+    *status = backend == FIR_BACKEND_OPENCL ? setupOpenCL(stream, engine, env) : CL_SUCCESS;
+    if(*status != CL_SUCCESS){
+        firStreamDestroy(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+void firStreamDestroy(FirStream* stream) {
+    if(stream == NULL)
+        return;
+    firClReleaseFilter(&stream->filter);
+    firClTapPlanRelease(&stream->clPlan);
+    firClBufferRelease(stream->inputMem);
+    firClBufferRelease(stream->outputMem);
+    firClBufferRelease(stream->tapsMem);
+    firFftDestroy(stream->fft);
+    firTapPlanDestroy(stream->plan);
+    firFftClDestroy(stream->fftCl);
+    free(stream->taps);
+    firClHostFree(stream->window);
+    free(stream);
+}
+
+void firStreamReset(FirStream* stream) {
+    memset(stream->window, 0, (stream->tapsCount - 1) * sizeof(short));
+}
+
+void firStreamSetPool(FirStream* stream, FirPool* pool) {
+    stream->pool = pool;
+}
+
+static cl_int filterWindow(FirStream* stream, size_t count, float* output) {
+    const size_t windowSize = count + stream->tapsCount - 1;
+    if(stream->backend == FIR_BACKEND_CPU){
+        if(stream->fft)
+            firFftFilter(stream->fft, stream->window, count, output);
+        else
+            firTapPlanFilter(stream->plan, stream->pool, stream->window, count, output);
+        return CL_SUCCESS;
+    }
+    cl_int status;
+    status = firClBufferWrite(&stream->env, stream->inputMem, windowSize * sizeof(short), stream->window, NULL);
+    if(status != CL_SUCCESS)
+        return status;
+    if(stream->fftCl)
+        status = firFftClEnqueue(stream->fftCl, stream->inputMem, count, stream->outputMem);
+    else if(stream->clPlan.kernel)
+        status = firClEnqueueTapPlan(&stream->env, stream->plan, &stream->clPlan, stream->inputMem, stream->outputMem,
+                                     (cl_uint)count, NULL);
+    else
+        status = firClEnqueueFilter(&stream->env, &stream->filter, stream->inputMem, stream->outputMem, stream->tapsMem,
+                                    (cl_uint)stream->tapsCount, (cl_uint)count, NULL);
+    if(status != CL_SUCCESS)
+        return status;
+    return firClBufferRead(&stream->env, stream->outputMem, count * sizeof(float), output, NULL);
+}
+
+cl_int firStreamProcess(FirStream* stream, const short* block, size_t count, float* output) {
+    const size_t history = stream->tapsCount - 1;
+    cl_int status = CL_SUCCESS;
+    while(count > 0){
+        size_t chunk = count < stream->maxBlock ? count : stream->maxBlock;
+        memcpy(stream->window + history, block, chunk * sizeof(short));
+        // After a failure the rest is only slid through the history
+        if(status == CL_SUCCESS)
+            status = filterWindow(stream, chunk, output);
+        // The newest tapsCount-1 samples become the history of the next chunk
+        memmove(stream->window, stream->window + chunk, history * sizeof(short));
+        block += chunk;
+        output += chunk;
+        count -= chunk;
+    }
+    return status;
+}
@@ -0,0 +1,40 @@
+#ifndef FIR_STREAM_H
+#define FIR_STREAM_H
+#include <stddef.h>
+#include "fir_cl.h"
+#include "cpu_pool.h"
+#include "fir_fft.h"
+#include "fir_plan.h"
+
+typedef enum {
+    FIR_BACKEND_CPU = 0,
+    FIR_BACKEND_OPENCL
+} FirBackend;
+
+typedef enum {
+    FIR_ENGINE_AUTO = 0,   // FFT from the measured crossover tap count up, direct below it
+    FIR_ENGINE_DIRECT,
+    FIR_ENGINE_FFT
+} FirEngine;
+
+// Causal streaming filter: keeps the last tapsCount-1 input samples between calls,
+// so output[n] = sum(x[n-(tapsCount-1)+j] * taps[j]) across block boundaries.
+// Taps and all host/device buffers are set up once in firStreamCreate; the direct engine
+// also plans the taps there and folds symmetric or skips zero taps (see fir_plan.h).
+typedef struct FirStream FirStream;
+
+// env is only used (and must stay alive) for FIR_BACKEND_OPENCL.
+// maxBlock is the largest chunk handled per launch; longer blocks are split internally.
+// NULL on failure, with the reason in status (may be NULL).
+FirStream* firStreamCreate(FirBackend backend, FirEngine engine, const FirClEnv* env,
+                           const float* taps, size_t tapsCount, size_t maxBlock, cl_int* status);
+void firStreamDestroy(FirStream* stream);
+// Forget the history (start of a new signal)
+void firStreamReset(FirStream* stream);
+// Let the direct CPU engine spread large blocks over a thread pool (NULL for single thread)
+void firStreamSetPool(FirStream* stream, FirPool* pool);
+// Filter count new samples into count outputs; count may be anything, including 0.
+// On an OpenCL error the outputs from the failing chunk on are not valid, while the
+// history still advances over every sample given.
+cl_int firStreamProcess(FirStream* stream, const short* block, size_t count, float* output);
+#endif // FIR_STREAM_H
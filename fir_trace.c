@@ -0,0 +1,230 @@
+#include "fir_trace.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// One traced call. A GPU call takes its slot at enqueue and is complete once sequence
+// holds its index + 1, written last by the completion callback.
+typedef struct {
+    const char* name;
+    FirTraceKind kind;
+    unsigned thread;
+    uint64_t index;
+    uint64_t host;           // host ns at enqueue
+    uint64_t start, end;     // host ns
+    uint64_t submitNs;       // queued to submit
+    uint64_t waitNs;         // queued to start
+    size_t bytes;
+    size_t samples;
+    uint64_t sequence;
+} FirTraceRecord;
+
+int firTraceFlag = 0;
+static FirTraceHistogram histograms[FIR_TRACE_KINDS];
+static FirTraceRecord records[FIR_TRACE_CAPACITY];
+static uint64_t recordNext = 0;
+static unsigned threadCount = 0;
+static __thread unsigned traceThread = 0;
+
+static const char* kindNames[FIR_TRACE_KINDS] = { "upload", "kernel", "readback", "cpu" };
+
+void firTraceEnable(bool on) {
+    __atomic_store_n(&firTraceFlag, on ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+void firTraceReset() {
+    for(int kind = 0; kind < FIR_TRACE_KINDS; kind++){
+        uint64_t* fields = (uint64_t*)&histograms[kind];
+        for(size_t i = 0; i < sizeof(FirTraceHistogram) / sizeof(uint64_t); i++)
+            __atomic_store_n(&fields[i], 0, __ATOMIC_RELAXED);
+    }
+    for(size_t i = 0; i < FIR_TRACE_CAPACITY; i++)
+        __atomic_store_n(&records[i].sequence, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&recordNext, 0, __ATOMIC_RELAXED);
+}
+
+uint64_t firTraceNow() {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if(frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    const uint64_t ticks = (uint64_t)counter.QuadPart, rate = (uint64_t)frequency.QuadPart;
+    return ticks / rate * 1000000000ULL + ticks % rate * 1000000000ULL / rate;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
+}
+
+static unsigned threadIndex() {
+    if(traceThread == 0)
+        traceThread = __atomic_add_fetch(&threadCount, 1, __ATOMIC_RELAXED);
+    return traceThread;
+}
+
+static void addHistogram(FirTraceKind kind, uint64_t ns, uint64_t submitNs, uint64_t waitNs, size_t bytes, size_t samples) {
+    FirTraceHistogram* histogram = &histograms[kind];
+    unsigned bucket = ns > 1 ? 63 - (unsigned)__builtin_clzll(ns) : 0;
+    if(bucket >= FIR_TRACE_BUCKETS)
+        bucket = FIR_TRACE_BUCKETS - 1;
+    __atomic_fetch_add(&histogram->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->samples, samples, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->totalNs, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->submitNs, submitNs, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->waitNs, waitNs, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&histogram->maxNs, __ATOMIC_RELAXED);
+    while(ns > max && !__atomic_compare_exchange_n(&histogram->maxNs, &max, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static FirTraceRecord* reserveRecord(FirTraceKind kind, const char* name, size_t bytes, size_t samples) {
+    const uint64_t index = __atomic_fetch_add(&recordNext, 1, __ATOMIC_RELAXED);
+    FirTraceRecord* record = &records[index % FIR_TRACE_CAPACITY];
+    __atomic_store_n(&record->sequence, 0, __ATOMIC_RELAXED);
+    record->name = name;
+    record->kind = kind;
+    record->thread = threadIndex();
+    record->index = index;
+    record->bytes = bytes;
+    record->samples = samples;
+    record->submitNs = 0;
+    record->waitNs = 0;
+    return record;
+}
+
+static void completeRecord(FirTraceRecord* record) {
+    addHistogram(record->kind, record->end - record->start, record->submitNs, record->waitNs, record->bytes, record->samples);
+    __atomic_store_n(&record->sequence, record->index + 1, __ATOMIC_RELEASE);
+}
+
+void firTraceHostCall(FirTraceKind kind, const char* name, uint64_t start, size_t bytes, size_t samples) {
+    FirTraceRecord* record = reserveRecord(kind, name, bytes, samples);
+    record->host = start;
+    record->start = start;
+    record->end = firTraceNow();
+    completeRecord(record);
+}
+
+cl_event* firTraceBeginCall(FirTraceCall* call, cl_event* event) {
+    call->active = true;
+    call->own = NULL;
+    call->host = firTraceNow();
+    return event != NULL ? event : &call->own;
+}
+
+// Device timestamps are shifted so the command's QUEUED time lands on its host enqueue time
+static void CL_CALLBACK traceComplete(cl_event event, cl_int eventStatus, void* user) {
+    FirTraceRecord* record = (FirTraceRecord*)user;
+    cl_ulong queued = 0, submit = 0, start = 0, end = 0;
+    cl_int status = clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(queued), &queued, NULL);
+    status |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(submit), &submit, NULL);
+    status |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+    status |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+    if(status == CL_SUCCESS && queued <= start && start <= end){
+        record->start = record->host + (start - queued);
+        record->end = record->host + (end - queued);
+        // Some drivers report SUBMIT as 0 or past START; it then counts as submitted at once
+        record->submitNs = queued <= submit && submit <= start ? submit - queued : 0;
+        record->waitNs = start - queued;
+    }
+    else{
+        record->start = record->host;
+        record->end = firTraceNow();
+    }
+    clReleaseEvent(event);
+    if(eventStatus == CL_COMPLETE)
+        completeRecord(record);
+}
+
+void firTraceEndCall(FirTraceCall* call, const cl_event* event, FirTraceKind kind, const char* name,
+                     cl_int status, size_t bytes, size_t samples) {
+    call->active = false;
+    cl_event traced = event != NULL ? *event : call->own;
+    if(status != CL_SUCCESS || traced == NULL)
+        return;
+    // The caller's event is kept alive for the callback; a private one is released by it
+    if(event != NULL)
+        clRetainEvent(traced);
+    FirTraceRecord* record = reserveRecord(kind, name, bytes, samples);
+    record->host = call->host;
+    if(clSetEventCallback(traced, CL_COMPLETE, traceComplete, record) != CL_SUCCESS)
+        traceComplete(traced, CL_COMPLETE, record);
+}
+
+void firTraceSnapshot(FirTraceStats* stats) {
+    for(int kind = 0; kind < FIR_TRACE_KINDS; kind++){
+        const uint64_t* from = (const uint64_t*)&histograms[kind];
+        uint64_t* to = (uint64_t*)&stats->kinds[kind];
+        for(size_t i = 0; i < sizeof(FirTraceHistogram) / sizeof(uint64_t); i++)
+            to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+    }
+    stats->recorded = __atomic_load_n(&recordNext, __ATOMIC_RELAXED);
+}
+
+uint64_t firTracePercentile(const FirTraceHistogram* histogram, double fraction) {
+    uint64_t calls = 0;
+    for(int b = 0; b < FIR_TRACE_BUCKETS; b++)
+        calls += histogram->buckets[b];
+    if(calls == 0)
+        return 0;
+    const double wanted = fraction * calls;
+    uint64_t seen = 0;
+    for(int b = 0; b < FIR_TRACE_BUCKETS; b++){
+        seen += histogram->buckets[b];
+        if(seen >= wanted && seen > 0)
+            return 2ULL << b;
+    }
+    return 2ULL << (FIR_TRACE_BUCKETS - 1);
+}
+
+const char* firTraceKindName(FirTraceKind kind) {
+    return kind < FIR_TRACE_KINDS ? kindNames[kind] : "unknown";
+}
+
+bool firTraceWrite(const char* path) {
+    FILE* file = fopen(path, "w");
+    if(file == NULL){
+        printf("Open file failed: %s\n", path);
+        return false;
+    }
+    const uint64_t total = __atomic_load_n(&recordNext, __ATOMIC_RELAXED);
+    const uint64_t first = total > FIR_TRACE_CAPACITY ? total - FIR_TRACE_CAPACITY : 0;
+    // Timestamps relative to the oldest call kept
+    uint64_t origin = UINT64_MAX;
+    for(uint64_t i = first; i < total; i++){
+        const FirTraceRecord* record = &records[i % FIR_TRACE_CAPACITY];
+        if(__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) == i + 1 && record->host < origin)
+            origin = record->host;
+    }
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"fir-filter\"}}");
+    for(int kind = 0; kind < FIR_TRACE_CPU; kind++)
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"device %s\"}}",
+                kind, kindNames[kind]);
+    const unsigned threads = __atomic_load_n(&threadCount, __ATOMIC_RELAXED);
+    for(unsigned thread = 1; thread <= threads; thread++)
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"cpu thread %u\"}}",
+                FIR_TRACE_KINDS + thread, thread);
+    for(uint64_t i = first; i < total; i++){
+        const FirTraceRecord* record = &records[i % FIR_TRACE_CAPACITY];
+        if(__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != i + 1)
+            continue;
+        const unsigned tid = record->kind == FIR_TRACE_CPU ? FIR_TRACE_KINDS + record->thread : (unsigned)record->kind;
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                      "\"args\":{\"bytes\":%zu,\"samples\":%zu,\"submit_us\":%.3f,\"wait_us\":%.3f,\"thread\":%u}}",
+                record->name, kindNames[record->kind], tid, (record->start - origin) / 1000.0,
+                (record->end - record->start) / 1000.0, record->bytes, record->samples,
+                record->submitNs / 1000.0, record->waitNs / 1000.0, record->thread);
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
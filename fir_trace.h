@@ -0,0 +1,97 @@
+#ifndef FIR_TRACE_H
+#define FIR_TRACE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <CL/cl.h>
+
+// What a traced call did; one histogram and one Chrome trace row each
+typedef enum {
+    FIR_TRACE_UPLOAD = 0,    // host to device transfers (and write maps)
+    FIR_TRACE_KERNEL,        // kernel launches
+    FIR_TRACE_READBACK,      // device to host transfers (and read maps)
+    FIR_TRACE_CPU,           // native engine calls
+    FIR_TRACE_KINDS
+} FirTraceKind;
+
+// Latency histogram buckets: bucket b counts calls of [2^b, 2^(b+1)) ns
+#define FIR_TRACE_BUCKETS 40
+// Calls kept for the Chrome trace; older ones are overwritten
+#define FIR_TRACE_CAPACITY (1 << 16)
+
+typedef struct {
+    uint64_t calls;
+    uint64_t bytes;          // transferred (uploads and readbacks)
+    uint64_t samples;        // outputs produced (kernels and CPU calls)
+    uint64_t totalNs;        // device execution time, or wall time for CPU calls
+    uint64_t maxNs;
+    uint64_t submitNs;       // queued to submit: host-side delay before the device sees it
+    uint64_t waitNs;         // queued to start: time spent behind other commands
+    uint64_t buckets[FIR_TRACE_BUCKETS];
+} FirTraceHistogram;
+
+typedef struct {
+    FirTraceHistogram kinds[FIR_TRACE_KINDS];
+    uint64_t recorded;       // calls written to the trace ring so far
+} FirTraceStats;
+
+// Tracing is off until enabled. Disabled, every hook costs one relaxed load and a branch.
+extern int firTraceFlag;
+static inline bool firTraceOn() {
+    return __atomic_load_n(&firTraceFlag, __ATOMIC_RELAXED) != 0;
+}
+void firTraceEnable(bool on);
+// Zero the counters, histograms and trace ring (no traced command may be in flight)
+void firTraceReset();
+
+// Monotonic host clock in nanoseconds
+uint64_t firTraceNow();
+
+// A call timed on the host that started at start (firTraceNow) and ends now: native
+// engine calls, and transfers whose copy runs on the host. name must outlive the trace
+// (a string literal).
+void firTraceHostCall(FirTraceKind kind, const char* name, uint64_t start, size_t bytes, size_t samples);
+static inline void firTraceHost(FirTraceKind kind, const char* name, uint64_t start, size_t bytes, size_t samples) {
+    if(start != 0)
+        firTraceHostCall(kind, name, start, bytes, samples);
+}
+static inline void firTraceCpu(const char* name, uint64_t start, size_t samples) {
+    firTraceHost(FIR_TRACE_CPU, name, start, 0, samples);
+}
+// Start time for firTraceHost and firTraceCpu, 0 when tracing is off
+static inline uint64_t firTraceStart() {
+    return firTraceOn() ? firTraceNow() : 0;
+}
+
+// Tracing an enqueue: pass firTraceBegin's event to the command, then firTraceEnd with its
+// status. When the caller asked for no event a private one is created and released again.
+// The queue needs CL_QUEUE_PROFILING_ENABLE for device timestamps; without it the call is
+// timed on the host from enqueue to completion.
+typedef struct {
+    bool active;
+    cl_event own;
+    uint64_t host;           // firTraceNow at enqueue, aligns the device clock to the host's
+} FirTraceCall;
+
+cl_event* firTraceBeginCall(FirTraceCall* call, cl_event* event);
+void firTraceEndCall(FirTraceCall* call, const cl_event* event, FirTraceKind kind, const char* name,
+                     cl_int status, size_t bytes, size_t samples);
+static inline cl_event* firTraceBegin(FirTraceCall* call, cl_event* event) {
+    call->active = false;
+    return firTraceOn() ? firTraceBeginCall(call, event) : event;
+}
+static inline void firTraceEnd(FirTraceCall* call, const cl_event* event, FirTraceKind kind, const char* name,
+                               cl_int status, size_t bytes, size_t samples) {
+    if(call->active)
+        firTraceEndCall(call, event, kind, name, status, bytes, samples);
+}
+
+// Counters and histograms as they are now; safe while traced calls run
+void firTraceSnapshot(FirTraceStats* stats);
+// Upper bound in ns of the latency below which fraction (0..1) of the calls fall
+uint64_t firTracePercentile(const FirTraceHistogram* histogram, double fraction);
+const char* firTraceKindName(FirTraceKind kind);
+// The trace ring as Chrome trace JSON (chrome://tracing, Perfetto): one row per kind for
+// the device, one per thread for CPU calls. Call once traced work has completed.
+bool firTraceWrite(const char* path);
+#endif // FIR_TRACE_H
@@ -0,0 +1,237 @@
+#include "fir_tune.h"
+#include "fir_cache.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+typedef struct FirClProfile {
+    char device[512];
+    size_t tapsCount;
+    unsigned bucket;
+    FirClTuning tuning;
+    struct FirClProfile* next;
+} FirClProfile;
+
+static FirClProfile* profiles = NULL;
+static bool profilesLoaded = false;
+static pthread_mutex_t tuneLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const size_t localSizes[] = {32, 64, 128, 256, 512, 1024};
+// 0 is the untiled FirFilter; kernel.cl has no 1-wide tiled variant
+static const cl_uint outputsPerItems[] = {0, 2, 4, 8, 16};
+
+static void deviceKey(const FirClEnv* env, char* key, size_t size) {
+    char name[256] = "", driver[128] = "";
+    clGetDeviceInfo(env->device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    clGetDeviceInfo(env->device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+    snprintf(key, size, "%s|%s", name, driver);
+}
+
+static unsigned outputBucket(size_t outputCount) {
+    unsigned bucket = 0;
+    while(outputCount > 1){
+        outputCount >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static bool profilePath(char* path, size_t size) {
+    char dir[960];
+    if(!firClCacheDir(dir, sizeof(dir)))
+        return false;
+    snprintf(path, size, "%s/%s", dir, FIR_TUNE_FILE);
+    return true;
+}
+
+static void addProfile(const char* device, size_t tapsCount, unsigned bucket, FirClTuning tuning) {
+    FirClProfile* profile = (FirClProfile*)calloc(1, sizeof(FirClProfile));
+    if(profile == NULL)
+        return;
+    snprintf(profile->device, sizeof(profile->device), "%.511s", device);
+    profile->tapsCount = tapsCount;
+    profile->bucket = bucket;
+    profile->tuning = tuning;
+    profile->next = profiles;
+    profiles = profile;
+}
+
+// Lines: device <TAB> taps <TAB> bucket <TAB> local size <TAB> outputs per item
+static void loadProfiles() {
+    char path[1024], line[1024];
+    profilesLoaded = true;
+    if(!profilePath(path, sizeof(path)))
+        return;
+    FILE* file = fopen(path, "r");
+    if(file == NULL)
+        return;
+    while(fgets(line, sizeof(line), file) != NULL){
+        char* tab = strchr(line, '\t');
+        unsigned long long tapsCount, localSize;
+        unsigned bucket, outputsPerItem;
+        if(tab == NULL)
+            continue;
+        *tab = '\0';
+        if(sscanf(tab + 1, "%llu\t%u\t%llu\t%u", &tapsCount, &bucket, &localSize, &outputsPerItem) == 4){
+            FirClTuning tuning = { (size_t)localSize, outputsPerItem };
+            addProfile(line, (size_t)tapsCount, bucket, tuning);
+        }
+    }
+    fclose(file);
+}
+
+static void saveProfile(const char* device, size_t tapsCount, unsigned bucket, FirClTuning tuning) {
+    char path[1024];
+    if(!profilePath(path, sizeof(path)))
+        return;
+    FILE* file = fopen(path, "a");
+    if(file == NULL)
+        return;
+    fprintf(file, "%s\t%zu\t%u\t%zu\t%u\n", device, tapsCount, bucket, tuning.localSize, tuning.outputsPerItem);
+    fclose(file);
+}
+
+static cl_int createFilter(const FirClEnv* env, size_t tapsCount, FirClTuning tuning, FirClFilter* filter) {
+    cl_int status;
+    if(tuning.outputsPerItem != 0)
+        return firClCreateFilterSized(env, tapsCount, FIR_INPUT_INT16, tuning.outputsPerItem, tuning.localSize, filter);
+    filter->kernel = clCreateKernel(env->program, "FirFilter", &status);
+    filter->outputsPerItem = 0;
+    filter->localSize = tuning.localSize;
+    filter->tapsCount = 0;
+    return status;
+}
+
+// Best of FIR_TUNE_REPS launches after one warm-up, in microseconds; negative if it fails
+static double measure(const FirClEnv* env, const FirClFilter* filter, cl_mem input, cl_mem output, cl_mem taps,
+                      size_t tapsCount, size_t outputCount) {
+    double best = -1.0;
+    for(int rep = 0; rep <= FIR_TUNE_REPS; rep++){
+        cl_event event;
+        struct timeval start, end;
+        gettimeofday(&start, NULL);
+        cl_int status = firClEnqueueFilter(env, filter, input, output, taps, (cl_uint)tapsCount, (cl_uint)outputCount, &event);
+        if(status != CL_SUCCESS)
+            return -1.0;
+        status = clWaitForEvents(1, &event);
+        gettimeofday(&end, NULL);
+        double time = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_usec - start.tv_usec);
+        cl_ulong begin = 0, finish = 0;
+        // Device time when the queue profiles, host time otherwise
+        if(clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(begin), &begin, NULL) == CL_SUCCESS
+           && clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(finish), &finish, NULL) == CL_SUCCESS)
+            time = (finish - begin) / 1000.0;
+        clReleaseEvent(event);
+        if(status != CL_SUCCESS)
+            return -1.0;
+        if(rep > 0 && (best < 0 || time < best))
+            best = time;
+    }
+    return best;
+}
+
+// Try every local size / outputs per item the device can hold and keep the fastest
+static cl_int tune(const FirClEnv* env, size_t tapsCount, size_t outputCount, FirClTuning* tuning) {
+    cl_int status;
+    size_t maxLocal = 0;
+    size_t maxItems[3] = {0, 0, 0};
+    clGetDeviceInfo(env->device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(maxLocal), &maxLocal, NULL);
+    clGetDeviceInfo(env->device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, NULL);
+    if(maxItems[0] != 0 && maxItems[0] < maxLocal)
+        maxLocal = maxItems[0];
+    if(outputCount > FIR_TUNE_MAX_OUTPUTS)
+        outputCount = FIR_TUNE_MAX_OUTPUTS;
+    if(outputCount == 0)
+        outputCount = 1;
+
+    // Zeroed data: uninitialized memory could hold denormals that skew the timings
+    const size_t inputCount = outputCount + tapsCount - 1;
+    void* zeros = calloc(inputCount > tapsCount ? inputCount : tapsCount, sizeof(float));
+    if(zeros == NULL)
+        return CL_OUT_OF_HOST_MEMORY;
+    cl_mem input = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, inputCount * sizeof(short), zeros, &status);
+    cl_mem output = clCreateBuffer(env->context, CL_MEM_WRITE_ONLY, outputCount * sizeof(float), NULL, &status);
+    cl_mem taps = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, tapsCount * sizeof(float), zeros, &status);
+    free(zeros);
+
+    double best = -1.0;
+    FirClTuning winner = { FIR_CL_LOCAL_SIZE, 0 };
+    if(input != NULL && output != NULL && taps != NULL){
+        for(size_t l = 0; l < sizeof(localSizes) / sizeof(localSizes[0]) && localSizes[l] <= maxLocal; l++){
+            for(size_t o = 0; o < sizeof(outputsPerItems) / sizeof(outputsPerItems[0]); o++){
+                FirClTuning candidate = { localSizes[l], outputsPerItems[o] };
+                if(candidate.outputsPerItem != 0 && tapsCount > firClMaxTiledTapsSized(env, candidate.outputsPerItem, candidate.localSize))
+                    continue;
+                FirClFilter filter;
+                if(createFilter(env, tapsCount, candidate, &filter) != CL_SUCCESS){
+                    firClReleaseFilter(&filter);
+                    continue;
+                }
+                size_t kernelLocal = 0;
+                clGetKernelWorkGroupInfo(filter.kernel, env->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelLocal), &kernelLocal, NULL);
+                double time = kernelLocal == 0 || candidate.localSize <= kernelLocal
+                            ? measure(env, &filter, input, output, taps, tapsCount, outputCount) : -1.0;
+                firClReleaseFilter(&filter);
+                if(time >= 0 && (best < 0 || time < best)){
+                    best = time;
+                    winner = candidate;
+                }
+            }
+        }
+    }
+    if(input)
+        clReleaseMemObject(input);
+    if(output)
+        clReleaseMemObject(output);
+    if(taps)
+        clReleaseMemObject(taps);
+    if(best < 0)
+        return status != CL_SUCCESS ? status : CL_INVALID_WORK_GROUP_SIZE;
+    *tuning = winner;
+    return CL_SUCCESS;
+}
+
+cl_int firClTune(const FirClEnv* env, size_t tapsCount, size_t outputCount, FirClTuning* tuning) {
+    char device[512];
+    deviceKey(env, device, sizeof(device));
+    const unsigned bucket = outputBucket(outputCount);
+    // Held across tuning so two threads never measure the same case at once
+    pthread_mutex_lock(&tuneLock);
+    if(!profilesLoaded)
+        loadProfiles();
+    for(FirClProfile* profile = profiles; profile != NULL; profile = profile->next){
+        if(profile->tapsCount == tapsCount && profile->bucket == bucket && strcmp(profile->device, device) == 0){
+            *tuning = profile->tuning;
+            pthread_mutex_unlock(&tuneLock);
+            return CL_SUCCESS;
+        }
+    }
+    cl_int status = tune(env, tapsCount, outputCount, tuning);
+    if(status == CL_SUCCESS){
+        addProfile(device, tapsCount, bucket, *tuning);
+        saveProfile(device, tapsCount, bucket, *tuning);
+    }
+    pthread_mutex_unlock(&tuneLock);
+    return status;
+}
+
+cl_int firClCreateTunedFilter(const FirClEnv* env, size_t tapsCount, size_t outputCount, FirClFilter* filter) {
+    FirClTuning tuning;
+    cl_int status = firClTune(env, tapsCount, outputCount, &tuning);
+    if(status != CL_SUCCESS)
+        return firClCreateFilter(env, tapsCount, FIR_INPUT_INT16, 0, filter);
+    return createFilter(env, tapsCount, tuning, filter);
+}
+
+void firClReleaseTunings() {
+    pthread_mutex_lock(&tuneLock);
+    while(profiles != NULL){
+        FirClProfile* next = profiles->next;
+        free(profiles);
+        profiles = next;
+    }
+    profilesLoaded = false;
+    pthread_mutex_unlock(&tuneLock);
+}
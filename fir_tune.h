@@ -0,0 +1,26 @@
+#ifndef FIR_TUNE_H
+#define FIR_TUNE_H
+#include <stddef.h>
+#include <CL/cl.h>
+#include "fir_cl.h"
+
+// Profiles live in this file of the program binary cache directory (see fir_cache.h),
+// one line per device/tap count/output-count bucket
+#define FIR_TUNE_FILE "tuning.txt"
+// Tuning launches cover at most this many outputs, and keep the best of this many runs
+#define FIR_TUNE_MAX_OUTPUTS (1 << 22)
+#define FIR_TUNE_REPS 3
+
+typedef struct {
+    size_t localSize;        // work-items per group
+    cl_uint outputsPerItem;  // 0 = untiled FirFilter
+} FirClTuning;
+
+// Fastest int16 direct-convolution configuration for tapsCount taps and launches of about
+// outputCount outputs (buckets are powers of two). Measured on the device the first time
+// and saved, later runs reuse the saved profile. Safe to call from several threads.
+cl_int firClTune(const FirClEnv* env, size_t tapsCount, size_t outputCount, FirClTuning* tuning);
+// firClTune followed by the matching firClCreateFilterSized
+cl_int firClCreateTunedFilter(const FirClEnv* env, size_t tapsCount, size_t outputCount, FirClFilter* filter);
+void firClReleaseTunings();
+#endif // FIR_TUNE_H
@@ -1,4 +1,5 @@
 #include "global.h"
+#include <string.h>
 bool init() {
     cl_int status;
 
@@ -10,12 +11,27 @@ bool init() {
     status = clGetPlatformIDs(num_platforms, platform, NULL);
     error(status, "Failed to create the platform list");
 
-    // Query the available OpenCL devices.
-    cl_uint num_devices;
-    status = clGetDeviceIDs( platform[1], CL_DEVICE_TYPE_GPU, 0, NULL, &num_devices);
-    error(status, "Failed count the devices");
+    // Query the available OpenCL devices: the first platform with a GPU, otherwise the
+    // first platform with any device (CPU runtimes such as PoCL)
+    cl_uint num_devices = 0;
+    cl_platform_id chosen = NULL;
+    const cl_device_type wanted[2] = {CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL};
+    cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+    for(int pass = 0; pass < 2 && chosen == NULL; pass++){
+        for(cl_uint i = 0; i < num_platforms; i++){
+            if(clGetDeviceIDs(platform[i], wanted[pass], 0, NULL, &num_devices) == CL_SUCCESS && num_devices > 0){
+                chosen = platform[i];
+                device_type = wanted[pass];
+                break;
+            }
+        }
+    }
+    if(chosen == NULL){
+        fprintf(stderr, "No OpenCL device found on %u platform(s).\n", num_platforms);
+        exit(1);
+    }
     device = (cl_device_id *) malloc(sizeof(cl_device_id)*(num_devices));
-    status = clGetDeviceIDs( platform[1], CL_DEVICE_TYPE_GPU, num_devices, device, NULL);
+    status = clGetDeviceIDs(chosen, device_type, num_devices, device, NULL);
     error(status, "Failed to create the device list");
 
     // Display some device information.
@@ -32,27 +48,33 @@ bool init() {
     queue = clCreateCommandQueue(context, device[0], CL_QUEUE_PROFILING_ENABLE, &status);
     error(status, "Failed to create command queue");
 
-    // Create the program.   (From .cl text file)
+    // Create the program.   (Embedded kernel.cl, or from .cl text file)
     //------------------------------------
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
 
-
+#ifdef FIR_EMBED_KERNEL
+    char* sourceCode = strdup(firKernelSource);
+#else
     char* sourceCode = readkernelFromFile(KERNEL_PATH);
+#endif
     if(sourceCode == NULL){
         fprintf(stderr, "Failed to load kernel.\n");
-        free(sourceCode);
         exit(1);
     }
+    // Kept for building specialized variants (firClVariantProgram)
+    kernelSource = sourceCode;
 
-    size_t sourceSize = _mbstrlen(sourceCode);
-    //printf("!%s\n", sourceCode);
-    //------------------------------------
-    program = clCreateProgramWithSource(context, 1, (const char**)&sourceCode, &sourceSize, &status);
-    error(status, "Failed to create program");
-
-    // Build the program that was just created.
-    status = clBuildProgram(program, 1, device, NULL, NULL, NULL);
+    // Reuses the device binary from a previous run when the cache key still matches
+    bool warm = false;
+    program = firClBuildCached(context, device[0], sourceCode, NULL, &warm, &status);
     error(status, "Failed to build program");
 
+    gettimeofday(&end, NULL);
+    printf("Program ready in %.2f ms (%s start)\n",
+           ((end.tv_sec - start.tv_sec) * 1000000LL + (end.tv_usec - start.tv_usec)) / 1000.0,
+           warm ? "warm, cached binary" : "cold, built from source");
+
     // Create the kernel
     kernel = clCreateKernel(program, "FirFilter", &status);
     error(status, "Failed to create kernel");
@@ -148,14 +170,19 @@ void display_device_info() {
 
 
 
-        // Get the number of OpenCL supported device available in this platform
-        cl_uint num_devices_available;
-        err_num = clGetDeviceIDs(cl_platforms[platform_idx], CL_DEVICE_TYPE_GPU, 0, NULL, &num_devices_available);
+        // Get the number of OpenCL supported device available in this platform (of any type,
+        // so CPU runtimes such as PoCL are listed; a platform without devices is skipped)
+        cl_uint num_devices_available = 0;
+        err_num = clGetDeviceIDs(cl_platforms[platform_idx], CL_DEVICE_TYPE_ALL, 0, NULL, &num_devices_available);
+        if(err_num == CL_DEVICE_NOT_FOUND || num_devices_available == 0) {
+            printf("\n\t\t [Platform %d] No devices available\n\n", platform_idx);
+            continue;
+        }
         check_cl_error(err_num, "clGetDeviceIDs: Get number of OpenCL supported devices available");
         printf("\n\t\t [Platform %d] Number of devices available: %d \n", platform_idx, num_devices_available);
         printf("\t\t ---------------------------------------------\n\n");
         cl_device_id cl_devices[num_devices_available];
-        err_num = clGetDeviceIDs(cl_platforms[platform_idx], CL_DEVICE_TYPE_GPU, num_devices_available, cl_devices, NULL);
+        err_num = clGetDeviceIDs(cl_platforms[platform_idx], CL_DEVICE_TYPE_ALL, num_devices_available, cl_devices, NULL);
         check_cl_error(err_num, "clGetDeviceIDs: Getting available OpenCL capable device id's");
 
         // Get attributes of each device
@@ -301,6 +328,8 @@ void error( cl_int status, const char* msg_to_print){
 
 // Free the resources allocated during initialization
 void cleanup() {
+    free(kernelSource);
+    kernelSource = NULL;
     if(kernel) {
         clReleaseKernel(kernel);
     }
@@ -316,8 +345,7 @@ void cleanup() {
 }
 
 long long cpuFilter(const short* input, const float* taps, float* output) {
-    struct timeval start, end;
-    mingw_gettimeofday(&start, NULL);
+    const uint64_t start = firTraceNow();
     for(unsigned int i = 0; i <= INPUT_SIZE-TAPS_SIZE; i++){
         for(unsigned int j = 0; j < TAPS_SIZE; j++){
             //            if((i+j) > INPUT_SIZE)
@@ -325,9 +353,19 @@ long long cpuFilter(const short* input, const float* taps, float* output) {
             output[i] += input[i+j] * taps[j];
         }
     }
-    mingw_gettimeofday(&end, NULL);
-    long long microseconds = (end.tv_sec - start.tv_sec)*1000000 +(end.tv_usec - start.tv_usec);
-    return (microseconds/1000);
+    return (long long)((firTraceNow() - start) / 1000000);
 }
 
+// Same filter through the runtime-dispatched SIMD engine; returns microseconds
+long long cpuFilterSimd(const short* input, const float* taps, float* output) {
+    const uint64_t start = firTraceNow();
+    firSimd(input, INPUT_SIZE-TAPS_SIZE+1, taps, TAPS_SIZE, output);
+    return (long long)((firTraceNow() - start) / 1000);
+}
 
+// SIMD engine spread over the pool's pinned workers; returns microseconds
+long long cpuFilterThreaded(FirPool* pool, const short* input, const float* taps, float* output) {
+    const uint64_t start = firTraceNow();
+    firPoolFilter(pool, input, INPUT_SIZE-TAPS_SIZE+1, taps, TAPS_SIZE, output);
+    return (long long)((firTraceNow() - start) / 1000);
+}
@@ -6,7 +6,25 @@
 #include <sys/time.h>
 #include <CL/cl.h>
 #include <stdbool.h>
+#include "cpu_simd.h"
+#include "cpu_pool.h"
+#include "fir_cl.h"
+#include "fir_fft.h"
+#include "fir_file.h"
+#include "fir_stream.h"
+#include "fir_cache.h"
+#include "fir_buffer.h"
+#include "fir_pipeline.h"
+#include "fir_sched.h"
+#include "fir_tune.h"
+#include "fir_batch.h"
+#include "fir_chain.h"
+#include "fir_multirate.h"
+#include "fir_plan.h"
+#include "fir_filter.h"
+#include "fir_trace.h"
 
+extern  char* kernelSource;
 extern  cl_platform_id* platform;
 extern  cl_device_id* device;
 extern  cl_context context;
@@ -19,7 +37,19 @@ extern  cl_program program;
 #define INPUT_SIZE 512
 //#define INPUT_SIZE 1024 * 256
 #define TAPS_SIZE (16)
+// Channels in the batched multichannel demo
+#define BATCH_CHANNELS 64
+// Rate changes in the multirate demo
+#define RATE_DECIMATE 8
+#define RATE_INTERPOLATE 4
+// Threads sharing the three handles of the filter handle demo, and outputs each computes
+#define HANDLE_THREADS 6
+#define HANDLE_OUTPUTS (1 << 18)
 #define KERNEL_PATH ((const char*)"D:\\fir-filter\\kernel.cl")
+#ifdef FIR_EMBED_KERNEL
+// kernel.cl linked into the executable (kernel_source.c), used instead of KERNEL_PATH
+extern const char firKernelSource[];
+#endif
 
 // Function prototypes
 bool init();
@@ -29,6 +59,8 @@ void error(cl_int status, const char* msg_to_print);
 void check_cl_error(cl_int err_num, const char* msg);
 char* readkernelFromFile(const char* filename);
 long long cpuFilter(const short* input, const float* taps, float* output);
+long long cpuFilterSimd(const short* input, const float* taps, float* output);
+long long cpuFilterThreaded(FirPool* pool, const short* input, const float* taps, float* output);
 #endif // GLOBAL_H
 
 
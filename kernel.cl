@@ -1,20 +1,339 @@
 __kernel void FirFilter(__global const short* input,
                         __global float* output,
-                        __constant const float* taps)
+                        __constant const float* taps,
+                        const uint tapsCount,
+                        const uint outputCount)
 {
-    const short gid = (short)get_global_id(0); //get id item
-    const uint gsize = get_global_size(0);
+    const uint gid = get_global_id(0); //get id item
+    if(gid >= outputCount){
+        return;
+    }
+    float sum = 0;
+    for(uint i = 0; i < tapsCount; i++){
+        sum += (input[gid+i] * taps[i]);
+    }
+    output[gid] = sum;
+}
+
+// Q15 fixed point (see FIR_Q15_SHIFT in cpu_simd.h): int32 sum of input*taps, rounded,
+// shifted back and saturated to int16. uint arithmetic wraps like the CPU path does.
+__kernel void FirFilterQ15(__global const short* input,
+                           __global short* output,
+                           __constant const short* taps,
+                           const uint tapsCount,
+                           const uint outputCount)
+{
+    const uint gid = get_global_id(0);
+    if(gid >= outputCount){
+        return;
+    }
+    uint acc = 0;
+    for(uint i = 0; i < tapsCount; i++){
+        acc += (uint)((int)input[gid+i] * (int)taps[i]);
+    }
+    output[gid] = convert_short_sat((int)(acc + (1u << 14)) >> 15);
+}
+
+// Many channels in one launch: dimension 0 is the output index, dimension 1 the channel.
+// Channel c reads input[c*inputStride ..], writes output[c*outputStride ..] and uses
+// taps[c*tapsStride ..], so tapsStride 0 shares one tap set across all channels.
+__kernel void FirFilterBatch(__global const short* input,
+                             __global float* output,
+                             __global const float* taps,
+                             const uint tapsCount,
+                             const uint outputCount,
+                             const uint inputStride,
+                             const uint outputStride,
+                             const uint tapsStride)
+{
+    const uint gid = get_global_id(0);
+    const size_t channel = get_global_id(1);
+    if(gid >= outputCount){
+        return;
+    }
+    __global const short* x = input + channel * inputStride + gid;
+    __global const float* h = taps + channel * tapsStride;
+    float sum = 0;
+    for(uint i = 0; i < tapsCount; i++){
+        sum += x[i] * h[i];
+    }
+    output[channel * outputStride + gid] = sum;
+}
+
+// Taps reduced by the planner (fir_plan.c) to termsCount coefficients at sample offsets.
+// mirror is 0 for a sparse list, +1/-1 when each term also adds/subtracts the sample at
+// tapsCount-1-offset (symmetric/antisymmetric folding). The group's input tile with its
+// tapsCount-1 halo is staged in local memory first; tile holds get_local_size(0) + tapsCount - 1 floats.
+__kernel void FirFilterPlanned(__global const short* input,
+                               __global float* output,
+                               __constant const float* coeffs,
+                               __constant const uint* offsets,
+                               const uint termsCount,
+                               const float mirror,
+                               const uint tapsCount,
+                               const uint outputCount,
+                               __local float* tile)
+{
+    const uint lid = get_local_id(0);
     const uint lsize = get_local_size(0);
-//    const uint localInputSize = (gsize-gid);
-//    __local float mass[128];
-    float sum = input[gid] * taps[0];
-    const uint grid = get_group_id(0);
-
-    for(int i = 1; i < lsize; i++){
-        if((gid+i) > gsize){
-            return;
+    const uint base = get_group_id(0) * lsize;
+    const uint tileSize = lsize + tapsCount - 1;
+    const uint inputCount = outputCount + tapsCount - 1;
+    for(uint i = lid; i < tileSize; i += lsize){
+        tile[i] = base + i < inputCount ? input[base + i] : 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if(base + lid >= outputCount){
+        return;
+    }
+    __local const float* x = tile + lid;
+    float sum = 0;
+    if(mirror != 0){
+        for(uint t = 0; t < termsCount; t++){
+            sum += coeffs[t] * (x[offsets[t]] + mirror * x[tapsCount - 1 - offsets[t]]);
         }
-        sum += (input[gid+i] * taps[i]);
+    }
+    else{
+        for(uint t = 0; t < termsCount; t++){
+            sum += coeffs[t] * x[offsets[t]];
+        }
+    }
+    output[base + lid] = sum;
+}
+
+// Decimation by factor: only the kept outputs, output[k] from input[k*factor ..]
+__kernel void FirDecimate(__global const short* input,
+                          __global float* output,
+                          __constant const float* taps,
+                          const uint tapsCount,
+                          const uint factor,
+                          const uint outputCount)
+{
+    const uint gid = get_global_id(0);
+    if(gid >= outputCount){
+        return;
+    }
+    __global const short* x = input + gid * factor;
+    float sum = 0;
+    for(uint i = 0; i < tapsCount; i++){
+        sum += x[i] * taps[i];
     }
     output[gid] = sum;
 }
+
+// Polyphase interpolation by factor: output m*factor+r applies phase r's phaseTapsCount
+// taps (row r of phaseTaps) to input[m ..], so the stuffed zeros are never multiplied
+__kernel void FirInterpolate(__global const short* input,
+                             __global float* output,
+                             __constant const float* phaseTaps,
+                             const uint phaseTapsCount,
+                             const uint factor,
+                             const uint outputCount)
+{
+    const uint gid = get_global_id(0);
+    if(gid >= outputCount){
+        return;
+    }
+    __global const short* x = input + gid / factor;
+    __constant const float* h = phaseTaps + (gid % factor) * phaseTapsCount;
+    float sum = 0;
+    for(uint i = 0; i < phaseTapsCount; i++){
+        sum += x[i] * h[i];
+    }
+    output[gid] = sum;
+}
+
+// Fused filter chain, built per chain with -D FIR_CHAIN_TAPS=<taps of stage 0>,<stage 1>,...
+// (see firClChainCreate); taps holds every stage's taps back to back. A work-group produces
+// perGroup final outputs: it stages perGroup + halo input samples in a, then each stage
+// filters one local tile into the other, shrinking by its tapsCount-1, and the last stage
+// writes straight to output. a and b each hold perGroup + halo floats.
+#ifdef FIR_CHAIN_TAPS
+__constant uint chainTaps[] = { FIR_CHAIN_TAPS };
+#define FIR_CHAIN_STAGES (sizeof(chainTaps) / sizeof(chainTaps[0]))
+
+__kernel void FirFilterChain(__global const short* input,
+                             __global float* output,
+                             __constant const float* taps,
+                             const uint outputCount,
+                             const uint perGroup,
+                             __local float* a,
+                             __local float* b)
+{
+    const uint lid = get_local_id(0);
+    const uint lsize = get_local_size(0);
+    const uint base = get_group_id(0) * perGroup;
+    uint halo = 0;
+    for(uint s = 0; s < FIR_CHAIN_STAGES; s++){
+        halo += chainTaps[s] - 1;
+    }
+    const uint inputCount = outputCount + halo;
+    uint count = perGroup + halo;
+    for(uint i = lid; i < count; i += lsize){
+        a[i] = base + i < inputCount ? input[base + i] : 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    __constant const float* h = taps;
+    __local float* src = a;
+    __local float* dst = b;
+    #pragma unroll
+    for(uint s = 0; s < FIR_CHAIN_STAGES; s++){
+        const uint tapsCount = chainTaps[s];
+        count -= tapsCount - 1;
+        for(uint i = lid; i < count; i += lsize){
+            float sum = 0;
+            for(uint j = 0; j < tapsCount; j++){
+                sum += src[i + j] * h[j];
+            }
+            if(s + 1 < FIR_CHAIN_STAGES){
+                dst[i] = sum;
+            }
+            else if(base + i < outputCount){
+                output[base + i] = sum;
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        __local float* swap = src;
+        src = dst;
+        dst = swap;
+        h += tapsCount;
+    }
+}
+#endif
+
+// Specialization knobs, passed as -D build options (see firClVariantProgram):
+//   FIR_TAPS              compile-time tap count, so the tap loop unrolls fully
+//   FIR_INPUT_T           input sample type, short (default) or float
+//   FIR_OUTPUTS_PER_ITEM  outputs per work-item: 2, 4 (default), 8 or 16
+#ifndef FIR_INPUT_T
+#define FIR_INPUT_T short
+#endif
+#ifndef FIR_OUTPUTS_PER_ITEM
+#define FIR_OUTPUTS_PER_ITEM 4
+#endif
+#define FIR_CAT_(a, b) a##b
+#define FIR_CAT(a, b) FIR_CAT_(a, b)
+#define FIR_VEC FIR_CAT(float, FIR_OUTPUTS_PER_ITEM)
+#define FIR_VLOAD FIR_CAT(vload, FIR_OUTPUTS_PER_ITEM)
+#define FIR_VSTORE FIR_CAT(vstore, FIR_OUTPUTS_PER_ITEM)
+#define FIR_CONVERT FIR_CAT(convert_float, FIR_OUTPUTS_PER_ITEM)
+
+// Each work-group stages its input tile plus the tapsCount-1 halo in local memory once,
+// then every work-item computes FIR_OUTPUTS_PER_ITEM consecutive outputs from it with
+// vector arithmetic. tile must hold get_local_size(0)*FIR_OUTPUTS_PER_ITEM + tapsCount - 1 floats.
+__kernel void FirFilterTiled(__global const FIR_INPUT_T* input,
+                             __global float* output,
+                             __constant const float* taps,
+                             const uint tapsCount,
+                             const uint outputCount,
+                             __local float* tile)
+{
+#ifdef FIR_TAPS
+    const uint tapsN = FIR_TAPS;
+#else
+    const uint tapsN = tapsCount;
+#endif
+    const uint opi = FIR_OUTPUTS_PER_ITEM;
+    const uint lid = get_local_id(0);
+    const uint lsize = get_local_size(0);
+    const uint groupStart = get_group_id(0) * lsize * opi;
+    const uint tileSize = lsize * opi + tapsN - 1;
+    const uint inputCount = outputCount + tapsN - 1;
+    const uint available = groupStart < inputCount ? inputCount - groupStart : 0;
+
+    for(uint i = lid * opi; i < tileSize; i += lsize * opi){
+        if(i + opi - 1 < available && i + opi - 1 < tileSize){
+            FIR_VSTORE(FIR_CONVERT(FIR_VLOAD(0, input + groupStart + i)), 0, tile + i);
+        }
+        else{
+            for(uint k = i; k < i + opi && k < tileSize; k++){
+                tile[k] = k < available ? (float)input[groupStart + k] : 0.0f;
+            }
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const uint first = lid * opi;
+    FIR_VEC sum = (FIR_VEC)(0.0f);
+#ifdef FIR_TAPS
+    #pragma unroll
+#endif
+    for(uint j = 0; j < tapsN; j++){
+        sum += FIR_VLOAD(0, tile + first + j) * taps[j];
+    }
+
+    const uint out = groupStart + first;
+    if(out + opi - 1 < outputCount){
+        FIR_VSTORE(sum, 0, output + out);
+    }
+    else{
+        float lanes[FIR_OUTPUTS_PER_ITEM];
+        FIR_VSTORE(sum, 0, lanes);
+        for(uint k = 0; k < opi && out + k < outputCount; k++){
+            output[out + k] = lanes[k];
+        }
+    }
+}
+
+// Overlap-save FFT convolution. Segment s holds input[s*hop .. s*hop+fftSize) as complex
+// values; every kernel below runs over all segments of a call at once.
+
+__kernel void OsLoad(__global const short* input,
+                     __global float2* segments,
+                     const uint hop,
+                     const uint fftSize,
+                     const uint inputCount)
+{
+    const uint gid = get_global_id(0);
+    const uint segment = gid / fftSize;
+    const uint index = segment*hop + gid % fftSize;
+    segments[gid] = (float2)(index < inputCount ? (float)input[index] : 0.0f, 0.0f);
+}
+
+// One radix-2 Stockham pass with butterfly span p; twiddles[m] = exp(-2*pi*i*m/fftSize)
+__kernel void FftRadix2(__global const float2* src,
+                        __global float2* dst,
+                        __global const float2* twiddles,
+                        const uint p,
+                        const uint fftSize)
+{
+    const uint gid = get_global_id(0);
+    const uint half = fftSize / 2;
+    const uint base = (gid / half) * fftSize;
+    const uint i = gid % half;
+    const uint k = i & (p - 1);
+    const float2 w = twiddles[k * (half / p)];
+    const float2 x0 = src[base + i];
+    float2 x1 = src[base + i + half];
+    x1 = (float2)(x1.x*w.x - x1.y*w.y, x1.x*w.y + x1.y*w.x);
+    const uint j = ((i - k) << 1) + k;
+    dst[base + j] = x0 + x1;
+    dst[base + j + p] = x0 - x1;
+}
+
+// Multiply by the tap spectrum and conjugate, so the next forward FFT is the inverse
+__kernel void OsMultiply(__global float2* segments,
+                         __global const float2* spectrum,
+                         const uint fftSize)
+{
+    const uint gid = get_global_id(0);
+    const float2 a = segments[gid];
+    const float2 h = spectrum[gid % fftSize];
+    segments[gid] = (float2)(a.x*h.x - a.y*h.y, -(a.x*h.y + a.y*h.x));
+}
+
+// Keep the hop valid outputs of each segment (the first tapsCount-1 are wrapped around)
+__kernel void OsStore(__global const float2* segments,
+                      __global float* output,
+                      const uint hop,
+                      const uint fftSize,
+                      const uint history,
+                      const uint outputCount)
+{
+    const uint gid = get_global_id(0);
+    if(gid >= outputCount){
+        return;
+    }
+    const uint segment = gid / hop;
+    output[gid] = segments[segment*fftSize + gid % hop + history].x / fftSize;
+}
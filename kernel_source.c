@@ -0,0 +1,23 @@
+#ifdef FIR_EMBED_KERNEL
+// Embeds kernel.cl as the NUL-terminated string firKernelSource. The assembler
+// resolves the file through -Wa,-I (see fir-filter.pri).
+#define FIR_STR(x) #x
+#define FIR_XSTR(x) FIR_STR(x)
+#define FIR_SYMBOL FIR_XSTR(__USER_LABEL_PREFIX__) "firKernelSource"
+
+#ifdef _WIN32
+#define FIR_RODATA ".section .rdata,\"dr\"\n"
+#else
+#define FIR_RODATA ".section .rodata\n"
+#endif
+
+__asm__(
+    FIR_RODATA
+    ".global " FIR_SYMBOL "\n"
+    ".balign 16\n"
+    FIR_SYMBOL ":\n"
+    ".incbin \"kernel.cl\"\n"
+    ".byte 0\n"
+    ".previous\n"
+);
+#endif
@@ -1,5 +1,8 @@
 #include "global.h"
+#include <pthread.h>
+#include <string.h>
 
+char* kernelSource;
 cl_platform_id* platform;
 cl_device_id* device;
 cl_context context;
@@ -7,17 +10,101 @@ cl_command_queue queue;
 cl_kernel kernel;
 cl_program program;
 
-int main()
+// One thread of the filter handle demo: its own output array, a handle shared with others
+typedef struct {
+    pthread_t thread;
+    FirFilter* filter;
+    const short* input;
+    size_t outputCount;
+    float* output;
+    cl_int status;
+} HandleJob;
+
+static void* runHandle(void* arg) {
+    HandleJob* job = (HandleJob*)arg;
+    job->status = firFilterExecute(job->filter, job->input, job->outputCount, job->output);
+    return NULL;
+}
+
+// Per-kind latency summary of the traced run, and its Chrome trace in path
+static void reportTrace(const char* path) {
+    FirTraceStats stats;
+    firTraceSnapshot(&stats);
+    for(int kind = 0; kind < FIR_TRACE_KINDS; kind++){
+        const FirTraceHistogram* histogram = &stats.kinds[kind];
+        if(histogram->calls == 0)
+            continue;
+        printf("Trace %-8s %6llu calls, %9.3f ms busy, p50 < %0.1f us, p99 < %0.1f us, max %0.1f us, "
+               "%0.3f ms to submit, %0.3f ms queued, %llu bytes, %llu samples\n", firTraceKindName((FirTraceKind)kind),
+               (unsigned long long)histogram->calls, histogram->totalNs / 1e6,
+               firTracePercentile(histogram, 0.5) / 1e3, firTracePercentile(histogram, 0.99) / 1e3,
+               histogram->maxNs / 1e3, histogram->submitNs / 1e6, histogram->waitNs / 1e6,
+               (unsigned long long)histogram->bytes, (unsigned long long)histogram->samples);
+    }
+    if(firTraceWrite(path))
+        printf("Trace of %llu calls written to %s\n", (unsigned long long)stats.recorded, path);
+}
+
+int main(int argc, char* argv[])
 {
     cl_int status;
+    // FIR_TRACE=<trace.json> times every transfer, launch and CPU engine call of the run
+    const char* tracePath = getenv("FIR_TRACE");
+    firTraceEnable(tracePath != NULL);
+    float* taps = malloc(sizeof(float)*TAPS_SIZE);
+    //Generate taps
+    for(int i = 0; i < TAPS_SIZE; i++){
+        if(i%2==0){
+            taps[i] = (float)0.5;
+        }
+        else{
+            taps[i] = (float)0;
+        }
+    }
+    // File mode: fir-filter <input.raw> <output.raw> [float|int16] [cpu|gpu] filters a raw
+    // int16 capture of any size with these taps instead of running the demo. OpenCL is only
+    // set up for the gpu backend, so the CPU path runs on hosts without an OpenCL runtime.
+    if(argc >= 3){
+        const FirFileFormat format = argc > 3 && strcmp(argv[3], "int16") == 0 ? FIR_FILE_INT16 : FIR_FILE_FLOAT32;
+        const FirBackend backend = argc > 4 && strcmp(argv[4], "gpu") == 0 ? FIR_BACKEND_OPENCL : FIR_BACKEND_CPU;
+        FirClEnv file_env = { NULL, NULL, NULL, NULL, NULL };
+        if(backend == FIR_BACKEND_OPENCL){
+            if(!init()) {
+                free(taps);
+                return -1;
+            }
+            file_env = (FirClEnv){ context, device[0], queue, program, kernelSource };
+        }
+        FirPool* file_pool = firPoolCreate(0);
+        FirFileStats stats;
+        bool done = firFileFilter(argv[1], argv[2], format, taps, TAPS_SIZE, backend, &file_env, file_pool, &stats);
+        firPoolDestroy(file_pool);
+        if(done){
+            printf("Filtered %zu samples on the %s in %0.3f s (%0.2f MSamples/s, %0.2f MB/s in)\n", stats.samples,
+                   backend == FIR_BACKEND_OPENCL ? "GPU" : "CPU", stats.seconds,
+                   stats.seconds > 0 ? stats.samples / stats.seconds / 1e6 : 0.0,
+                   stats.seconds > 0 ? stats.samples * sizeof(short) / stats.seconds / 1e6 : 0.0);
+        }
+        if(tracePath != NULL)
+            reportTrace(tracePath);
+        firClReleaseBuffers();
+        firClReleaseTunings();
+        firFftReleaseCrossovers();
+        firClReleaseVariants();
+        cleanup();
+        free(taps);
+        return done ? 0 : 1;
+    }
     if(!init()) {
+        free(taps);
         return -1;
     }
     // Set the memory elements
     printf("\nAllocating memory on the device.\n");
-    short* inputs = malloc(sizeof(short)*INPUT_SIZE);
-    float* outputs = malloc(sizeof(float)*INPUT_SIZE);
-    float* taps = malloc(sizeof(float)*TAPS_SIZE);
+    FirClEnv env = { context, device[0], queue, program, kernelSource };
+    // Page-aligned so zero-copy devices use them in place
+    short* inputs = firClHostAlloc(sizeof(short)*INPUT_SIZE);
+    float* outputs = firClHostAlloc(sizeof(float)*INPUT_SIZE);
     srand(time(0));
 
     //Generate a random input
@@ -40,58 +127,33 @@ int main()
         }
         outputs[i] = 0;
     }
-    //Generate taps
-    for(int i = 0; i < TAPS_SIZE; i++){
-        if(i%2==0){
-            taps[i] = (float)0.5;
-        }
-        else{
-            taps[i] = (float)0;
-        }
-    }
-    // Create memory buffer on the device for the vector
-
-    cl_mem Input_clmem = clCreateBuffer(context, CL_MEM_READ_ONLY, (INPUT_SIZE) * sizeof(short), NULL, &status);
-    clCreateBuffer(context, CL_MEM_READ_ONLY, (INPUT_SIZE)*sizeof(short), NULL, &status);
+    // Create memory buffer on the device for the vector (wrapping the host arrays on zero-copy devices)
+    printf("Host buffers: %s\n", firClZeroCopy(&env) ? "zero-copy (mapped)" : "copied");
+    cl_mem Input_clmem = firClBufferAcquire(&env, CL_MEM_READ_ONLY, (INPUT_SIZE) * sizeof(short), inputs, &status);
     error(status, "Failed to create memory for input");
-    cl_mem Output_clmem = clCreateBuffer(context, CL_MEM_WRITE_ONLY, (INPUT_SIZE) * sizeof(float), NULL, &status);
+    cl_mem Output_clmem = firClBufferAcquire(&env, CL_MEM_WRITE_ONLY, (INPUT_SIZE) * sizeof(float), outputs, &status);
     error(status, "Failed to create memory for output");
-    cl_mem Taps_clmem = clCreateBuffer(context, CL_MEM_READ_ONLY, (TAPS_SIZE) * sizeof(float), NULL, &status);
+    cl_mem Taps_clmem = firClBufferAcquire(&env, CL_MEM_READ_ONLY, (TAPS_SIZE) * sizeof(float), NULL, &status);
     error(status, "Failed to create memory for taps");
     //Create events for time control
     cl_event input_event, kernel_event, read_event;
 
     //Copy the buffers to the device
-    status = clEnqueueWriteBuffer(queue, Input_clmem, CL_TRUE, 0, (INPUT_SIZE) * sizeof(short), inputs, 0, NULL, &input_event);
-    status = clEnqueueWriteBuffer(queue, Taps_clmem, CL_TRUE, 0, (TAPS_SIZE) * sizeof(float), taps, 0, NULL, NULL);
+    status = firClBufferWrite(&env, Input_clmem, (INPUT_SIZE) * sizeof(short), inputs, &input_event);
+    error(status, "Failed to write the input");
+    status = firClBufferWrite(&env, Taps_clmem, (TAPS_SIZE) * sizeof(float), taps, NULL);
+    error(status, "Failed to write the taps");
 
     printf(stderr, "\nKernel initialization is complete.\n");
 
-    // Set the arguments of the kernel
-    status = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&Input_clmem);
-    error(status, "Failed to set kernel arg 1 - input_clmem");
-    status = clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&Output_clmem);
-    error(status, "Failed to set kernel arg 2 - output_clmem");
-    status = clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&Taps_clmem);
-    error(status, "Failed to set kernel arg 3 - taps_clmem");
+    cl_uint tapsCount = TAPS_SIZE;
+    cl_uint outputCount = INPUT_SIZE-TAPS_SIZE+1;
 
-
-    // Launch the Kernel
+    // Launch the Kernel over every output, the global range rounded up to whole work-groups
     status = clFinish(queue);
     error(status, "Failed to launch kernel");
-    unsigned int razm = 1;
-    while (razm < TAPS_SIZE)
-      razm *= 2;
-    size_t local_work_size[3] = {razm, 1, 1};
-    unsigned int glsize;
-    if(INPUT_SIZE < 1024)
-      glsize = INPUT_SIZE;
-     else
-      glsize = 1024;
-
-
-    size_t global_work_size[3] = {glsize, 1, 1};
-    status = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, global_work_size, local_work_size, 0, NULL, &kernel_event);
+    FirClFilter naive_filter = { kernel, 0, FIR_CL_LOCAL_SIZE, 0 };
+    status = firClEnqueueFilter(&env, &naive_filter, Input_clmem, Output_clmem, Taps_clmem, tapsCount, outputCount, &kernel_event);
     error(status, "Failed to launch kernel");
     status = clFinish(queue);
     error(status, "Failed to finish (after execution)");
@@ -99,16 +161,360 @@ int main()
     printf(" Done! \n");
 
     // Read the cl memory Output_clmem on device to the host variable Output
-    status = clEnqueueReadBuffer(queue, Output_clmem, CL_TRUE, 0, INPUT_SIZE * sizeof(float), outputs, 0, NULL, &read_event);
+    status = firClBufferRead(&env, Output_clmem, INPUT_SIZE * sizeof(float), outputs, &read_event);
     error(status, "Failed read the variable output");
 
     // Wait for command queue to complete pending events
     status = clFinish(queue);
     error(status, "Failed to finish");
 
+    // Same filter with the local size, outputs per work-item and tile tuned for this device
+    cl_event tiled_event;
+    FirClFilter tiled_filter;
+    FirClTuning tuning;
+    status = firClTune(&env, TAPS_SIZE, outputCount, &tuning);
+    error(status, "Failed to tune the kernel");
+    printf("Tuned %d taps x %u outputs: %zu work-items per group, %s\n", TAPS_SIZE, outputCount,
+           tuning.localSize, tuning.outputsPerItem ? "tiled" : "untiled");
+    if(tuning.outputsPerItem)
+        printf("  %u outputs per work-item, tile of %zu floats\n", tuning.outputsPerItem,
+               tuning.localSize * tuning.outputsPerItem + TAPS_SIZE - 1);
+    status = firClCreateTunedFilter(&env, TAPS_SIZE, outputCount, &tiled_filter);
+    error(status, "Failed to create tuned kernel");
+    status = firClEnqueueFilter(&env, &tiled_filter, Input_clmem, Output_clmem, Taps_clmem, TAPS_SIZE, outputCount, &tiled_event);
+    error(status, "Failed to launch tiled kernel");
+    float* outputs_tiled = malloc(sizeof(float)*INPUT_SIZE);
+    status = firClBufferRead(&env, Output_clmem, outputCount * sizeof(float), outputs_tiled, NULL);
+    error(status, "Failed read the tiled output");
+
+    // Q15 fixed point: int16 taps and outputs, half the readback of the float path
+    short* taps_q15 = malloc(sizeof(short)*TAPS_SIZE);
+    firQ15Taps(taps, TAPS_SIZE, taps_q15);
+    cl_event q15_event;
+    FirClFilter q15_filter;
+    status = firClCreateFilterQ15(&env, &q15_filter);
+    error(status, "Failed to create Q15 kernel");
+    cl_mem TapsQ15_clmem = firClBufferAcquire(&env, CL_MEM_READ_ONLY, TAPS_SIZE * sizeof(short), NULL, &status);
+    error(status, "Failed to create memory for Q15 taps");
+    cl_mem OutputQ15_clmem = firClBufferAcquire(&env, CL_MEM_WRITE_ONLY, INPUT_SIZE * sizeof(short), NULL, &status);
+    error(status, "Failed to create memory for Q15 output");
+    status = firClBufferWrite(&env, TapsQ15_clmem, TAPS_SIZE * sizeof(short), taps_q15, NULL);
+    error(status, "Failed to write the Q15 taps");
+    status = firClEnqueueFilter(&env, &q15_filter, Input_clmem, OutputQ15_clmem, TapsQ15_clmem, tapsCount, outputCount, &q15_event);
+    error(status, "Failed to launch Q15 kernel");
+    short* outputs_q15 = malloc(sizeof(short)*INPUT_SIZE);
+    status = firClBufferRead(&env, OutputQ15_clmem, outputCount * sizeof(short), outputs_q15, NULL);
+    error(status, "Failed read the Q15 output");
+
     printf("Comparing with CPU code...\n");
-    float* result_cpu = malloc(sizeof(float)*INPUT_SIZE);
+    float* result_cpu = calloc(INPUT_SIZE, sizeof(float));
     long long timeCPU = cpuFilter(inputs, taps, result_cpu);
+    float* result_simd = calloc(INPUT_SIZE, sizeof(float));
+    long long timeSIMD = cpuFilterSimd(inputs, taps, result_simd);
+    float simdError = firSimdCheck(inputs, INPUT_SIZE-TAPS_SIZE+1, taps, TAPS_SIZE, result_simd, result_cpu);
+    FirPool* pool = firPoolCreate(0);
+    float* result_threads = calloc(INPUT_SIZE, sizeof(float));
+    long long timeThreads = cpuFilterThreaded(pool, inputs, taps, result_threads);
+    float threadsError = firSimdCheck(inputs, INPUT_SIZE-TAPS_SIZE+1, taps, TAPS_SIZE, result_threads, result_cpu);
+    float tiledError = firSimdCheck(inputs, INPUT_SIZE-TAPS_SIZE+1, taps, TAPS_SIZE, outputs_tiled, result_cpu);
+    short* result_q15 = calloc(INPUT_SIZE, sizeof(short));
+    firSimdQ15(inputs, INPUT_SIZE-TAPS_SIZE+1, taps_q15, TAPS_SIZE, result_q15);
+    float q15Error = 0;
+    for(int i = 0; i <= INPUT_SIZE-TAPS_SIZE; i++){
+        float diff = result_q15[i] - result_cpu[i];
+        if(diff < 0)
+            diff = -diff;
+        if(diff > q15Error)
+            q15Error = diff;
+    }
+
+    // Stream the same signal in uneven blocks; after the TAPS_SIZE-1 warm-up samples
+    // the output must equal the one-shot result with no seams at block boundaries
+    printf("Streaming in blocks...\n");
+    float* result_stream = malloc(sizeof(float)*INPUT_SIZE);
+    float streamError[2];
+    for(int backend = FIR_BACKEND_CPU; backend <= FIR_BACKEND_OPENCL; backend++){
+        FirStream* stream = firStreamCreate((FirBackend)backend, FIR_ENGINE_AUTO, &env, taps, TAPS_SIZE, 100, &status);
+        error(status, "Failed to create stream");
+        firStreamSetPool(stream, pool);
+        for(int pos = 0, block = 1; pos < INPUT_SIZE; pos += block, block = block*3 % 97 + 1){
+            if(block > INPUT_SIZE - pos)
+                block = INPUT_SIZE - pos;
+            status = firStreamProcess(stream, inputs + pos, block, result_stream + pos);
+            error(status, "Failed to process stream block");
+        }
+        firStreamDestroy(stream);
+        streamError[backend] = firSimdCheck(inputs, INPUT_SIZE-TAPS_SIZE+1, taps, TAPS_SIZE,
+                                            result_stream + TAPS_SIZE-1, result_cpu);
+    }
+    free(result_stream);
+
+    // Plan the demo taps (every odd tap is zero) and a symmetric triangle on both backends
+    printf("Planning tap structure...\n");
+    float* sym_taps = malloc(sizeof(float)*TAPS_SIZE);
+    for(int i = 0; i < TAPS_SIZE; i++)
+        sym_taps[i] = (float)(i < TAPS_SIZE-1-i ? i+1 : TAPS_SIZE-i) / TAPS_SIZE;
+    float* result_plan = malloc(sizeof(float)*INPUT_SIZE);
+    float* plan_reference = malloc(sizeof(float)*INPUT_SIZE);
+    const float* plan_taps[2] = { taps, sym_taps };
+    FirTapStructure planStructure[2];
+    size_t planMultiplies[2];
+    float planError[2][2];
+    for(int set = 0; set < 2; set++){
+        FirTapPlan* plan = firTapPlanCreate(plan_taps[set], TAPS_SIZE);
+        planStructure[set] = firTapPlanStructure(plan);
+        planMultiplies[set] = firTapPlanMultiplies(plan);
+        cpuFilter(inputs, plan_taps[set], plan_reference);
+        firTapPlanFilter(plan, pool, inputs, outputCount, result_plan);
+        planError[set][0] = firSimdCheck(inputs, outputCount, plan_taps[set], TAPS_SIZE, result_plan, plan_reference);
+        FirClTapPlan cl_plan;
+        planError[set][1] = 0;
+        if(firClTapPlanCreate(&env, plan, &cl_plan) == CL_SUCCESS){
+            status = firClEnqueueTapPlan(&env, plan, &cl_plan, Input_clmem, Output_clmem, outputCount, NULL);
+            error(status, "Failed to launch planned kernel");
+            status = firClBufferRead(&env, Output_clmem, outputCount * sizeof(float), result_plan, NULL);
+            error(status, "Failed read the planned output");
+            planError[set][1] = firSimdCheck(inputs, outputCount, plan_taps[set], TAPS_SIZE, result_plan, plan_reference);
+            firClTapPlanRelease(&cl_plan);
+        }
+        firTapPlanDestroy(plan);
+    }
+    free(sym_taps);
+    free(result_plan);
+    free(plan_reference);
+
+    // DC block -> 4-sample average -> demo taps as one fused chain, against the stages run
+    // one after the other through full intermediate arrays
+    printf("Running a fused filter chain...\n");
+    const float dc_block[2] = { 0.5f, -0.5f };
+    const float average[4] = { 0.25f, 0.25f, 0.25f, 0.25f };
+    const float* chain_taps[3] = { dc_block, average, taps };
+    const size_t chain_counts[3] = { 2, 4, TAPS_SIZE };
+    FirChain* chain = firChainCreate(chain_taps, chain_counts, 3);
+    const size_t chainOutputs = INPUT_SIZE - firChainHalo(chain);
+    float* chain_staged = malloc(sizeof(float)*INPUT_SIZE);
+    float* chain_scratch = malloc(sizeof(float)*INPUT_SIZE);
+    size_t stagedCount = INPUT_SIZE - 1;
+    firSimd(inputs, stagedCount, dc_block, 2, chain_staged);
+    for(size_t stage = 1; stage < 3; stage++){
+        stagedCount -= chain_counts[stage] - 1;
+        for(size_t i = 0; i < stagedCount; i++){
+            float sum = 0;
+            for(size_t j = 0; j < chain_counts[stage]; j++)
+                sum += chain_staged[i + j] * chain_taps[stage][j];
+            chain_scratch[i] = sum;
+        }
+        memcpy(chain_staged, chain_scratch, stagedCount * sizeof(float));
+    }
+    float* result_chain = malloc(sizeof(float)*INPUT_SIZE);
+    status = firChainFilter(chain, pool, inputs, chainOutputs, result_chain);
+    error(status, "Failed to run the filter chain");
+    float chainError[2] = {0, 2.0f};
+    for(size_t i = 0; i < chainOutputs; i++){
+        float diff = result_chain[i] - chain_staged[i];
+        if(diff < 0)
+            diff = -diff;
+        if(diff > chainError[0])
+            chainError[0] = diff;
+    }
+    FirClChain cl_chain;
+    cl_event chain_event = NULL;
+    if(firClChainCreate(&env, chain, &cl_chain) == CL_SUCCESS){
+        status = firClEnqueueChain(&env, chain, &cl_chain, Input_clmem, Output_clmem, chainOutputs, &chain_event);
+        error(status, "Failed to launch chain kernel");
+        status = firClBufferRead(&env, Output_clmem, chainOutputs * sizeof(float), result_chain, NULL);
+        error(status, "Failed read the chain output");
+        chainError[1] = 0;
+        for(size_t i = 0; i < chainOutputs; i++){
+            float diff = result_chain[i] - chain_staged[i];
+            if(diff < 0)
+                diff = -diff;
+            if(diff > chainError[1])
+                chainError[1] = diff;
+        }
+        firClChainRelease(&cl_chain);
+    }
+    // Global bytes per final output: int16 in and float out once fused, plus a float
+    // round trip per intermediate stage when staged
+    const double chainBytes = (double)(cl_chain.perGroup + firChainHalo(chain)) * sizeof(cl_short) / cl_chain.perGroup + sizeof(cl_float);
+    const double stagedBytes = sizeof(cl_short) + sizeof(cl_float) + 2 * 2 * sizeof(cl_float);
+    firChainDestroy(chain);
+    free(chain_staged);
+    free(chain_scratch);
+    free(result_chain);
+
+    // Decimate by RATE_DECIMATE and interpolate by RATE_INTERPOLATE in the same uneven blocks,
+    // against the causal filter of the zero-padded (and for interpolation zero-stuffed) signal
+    printf("Decimating and interpolating...\n");
+    const size_t stuffedCount = (TAPS_SIZE-1) + INPUT_SIZE*RATE_INTERPOLATE;
+    short* stuffed = calloc(stuffedCount, sizeof(short));
+    float* rate_reference = malloc(sizeof(float)*INPUT_SIZE*RATE_INTERPOLATE);
+    float* result_rate = malloc(sizeof(float)*INPUT_SIZE*RATE_INTERPOLATE);
+    float rateError[2][2];
+    for(int mode = FIR_DECIMATE; mode <= FIR_INTERPOLATE; mode++){
+        const size_t factor = mode == FIR_DECIMATE ? RATE_DECIMATE : RATE_INTERPOLATE;
+        // Input samples lie spacing apart in the reference; every step-th reference output is kept
+        const size_t spacing = mode == FIR_DECIMATE ? 1 : factor;
+        const size_t step = mode == FIR_DECIMATE ? factor : 1;
+        memset(stuffed, 0, stuffedCount * sizeof(short));
+        for(int i = 0; i < INPUT_SIZE; i++)
+            stuffed[TAPS_SIZE-1 + i*spacing] = inputs[i];
+        firSimd(stuffed, INPUT_SIZE*spacing, taps, TAPS_SIZE, rate_reference);
+        for(int backend = FIR_BACKEND_CPU; backend <= FIR_BACKEND_OPENCL; backend++){
+            FirMultirate* rate = firMultirateCreate((FirBackend)backend, &env, (FirRateMode)mode, factor, taps, TAPS_SIZE, 100, &status);
+            error(status, "Failed to create multirate filter");
+            size_t written = 0;
+            for(int pos = 0, block = 1; pos < INPUT_SIZE; pos += block, block = block*3 % 97 + 1){
+                if(block > INPUT_SIZE - pos)
+                    block = INPUT_SIZE - pos;
+                size_t blockWritten;
+                status = firMultirateProcess(rate, inputs + pos, block, result_rate + written, &blockWritten);
+                error(status, "Failed to process multirate block");
+                written += blockWritten;
+            }
+            firMultirateDestroy(rate);
+            float worst = written == (INPUT_SIZE*spacing + step - 1) / step ? 0 : 1;
+            for(size_t k = 0; k < written; k++){
+                float diff = result_rate[k] - rate_reference[k * step];
+                if(diff < 0)
+                    diff = -diff;
+                if(diff > worst)
+                    worst = diff;
+            }
+            rateError[mode][backend] = worst;
+        }
+    }
+    free(stuffed);
+    free(rate_reference);
+    free(result_rate);
+
+    // Every OpenCL device of every platform plus the native CPU engine on one input
+    printf("Scheduling across devices...\n");
+    float* result_sched = calloc(INPUT_SIZE, sizeof(float));
+    FirScheduler* scheduler = firSchedCreate(taps, TAPS_SIZE, kernelSource, FIR_SCHED_ALL, pool);
+    float schedError = 2.0f;
+    if(scheduler != NULL){
+        status = firSchedFilter(scheduler, inputs, INPUT_SIZE-TAPS_SIZE+1, result_sched);
+        error(status, "Failed to run the scheduler");
+        schedError = firSimdCheck(inputs, INPUT_SIZE-TAPS_SIZE+1, taps, TAPS_SIZE, result_sched, result_cpu);
+    }
+
+    // Three independent filter handles shared by HANDLE_THREADS threads executing at the same
+    // time: the demo taps on the default device, and a triangle and the demo taps on the CPU,
+    // both CPU handles spreading over the same pool. The signal is long enough for the pool
+    // to split it, so the two CPU handles really do contend for the workers.
+    printf("Filtering through %d threads on three handles...\n", HANDLE_THREADS);
+    float* triangle = malloc(sizeof(float)*TAPS_SIZE);
+    for(int i = 0; i < TAPS_SIZE; i++)
+        triangle[i] = (float)(i < TAPS_SIZE-1-i ? i+1 : TAPS_SIZE-i) / TAPS_SIZE;
+    short* handle_inputs = malloc(sizeof(short)*(HANDLE_OUTPUTS+TAPS_SIZE-1));
+    for(int i = 0; i < HANDLE_OUTPUTS+TAPS_SIZE-1; i++)
+        handle_inputs[i] = (short)(rand() % 2001 - 1000);
+    const float* handle_taps[3] = { taps, triangle, taps };
+    FirFilterConfig handle_config[3] = {
+        { FIR_BACKEND_OPENCL, 0, kernelSource, NULL, taps, TAPS_SIZE, 0 },
+        { FIR_BACKEND_CPU, 0, NULL, pool, triangle, TAPS_SIZE, 0 },
+        { FIR_BACKEND_CPU, 0, NULL, pool, taps, TAPS_SIZE, 0 }
+    };
+    FirFilter* handles[3];
+    float* handle_reference[3];
+    for(int h = 0; h < 3; h++){
+        handles[h] = firFilterCreate(&handle_config[h], &status);
+        error(status, "Failed to create a filter handle");
+        handle_reference[h] = malloc(sizeof(float)*HANDLE_OUTPUTS);
+        firSimd(handle_inputs, HANDLE_OUTPUTS, handle_taps[h], TAPS_SIZE, handle_reference[h]);
+    }
+    HandleJob handle_jobs[HANDLE_THREADS];
+    for(int t = 0; t < HANDLE_THREADS; t++){
+        HandleJob job = { 0, handles[t % 3], handle_inputs, HANDLE_OUTPUTS, malloc(sizeof(float)*HANDLE_OUTPUTS), CL_SUCCESS };
+        handle_jobs[t] = job;
+        if(pthread_create(&handle_jobs[t].thread, NULL, runHandle, &handle_jobs[t]) != 0)
+            error(CL_OUT_OF_RESOURCES, "Failed to start a filter thread");
+    }
+    float handleError = 0;
+    for(int t = 0; t < HANDLE_THREADS; t++){
+        pthread_join(handle_jobs[t].thread, NULL);
+        error(handle_jobs[t].status, "Failed to execute a filter handle");
+        const float diff = firSimdCheck(handle_inputs, HANDLE_OUTPUTS, handle_taps[t % 3], TAPS_SIZE,
+                                        handle_jobs[t].output, handle_reference[t % 3]);
+        if(diff > handleError)
+            handleError = diff;
+        free(handle_jobs[t].output);
+    }
+    char handleDevice[128];
+    snprintf(handleDevice, sizeof(handleDevice), "%s", firFilterDeviceName(handles[0]));
+    for(int h = 0; h < 3; h++){
+        firFilterDestroy(handles[h]);
+        free(handle_reference[h]);
+    }
+    free(handle_inputs);
+    free(triangle);
+
+    // BATCH_CHANNELS variants of the signal (channel c offset by c) in one 2D launch on the
+    // GPU and in the channel-interleaved layout on the CPU, checked against firSimd per channel
+    printf("Filtering %d channels in one batch...\n", BATCH_CHANNELS);
+    const size_t batchSamples = INPUT_SIZE, batchOutputs = INPUT_SIZE-TAPS_SIZE+1;
+    short* batch_inputs = malloc(sizeof(short)*BATCH_CHANNELS*batchSamples);
+    short* batch_interleaved = malloc(sizeof(short)*BATCH_CHANNELS*batchSamples);
+    float* batch_gpu = malloc(sizeof(float)*BATCH_CHANNELS*batchOutputs);
+    float* batch_cpu = malloc(sizeof(float)*BATCH_CHANNELS*batchOutputs);
+    float* batch_planar = malloc(sizeof(float)*BATCH_CHANNELS*batchOutputs);
+    for(size_t c = 0; c < BATCH_CHANNELS; c++){
+        for(size_t i = 0; i < batchSamples; i++)
+            batch_inputs[c*batchSamples + i] = (short)(inputs[i] + c);
+    }
+    cl_event batch_event;
+    FirClFilter batch_filter;
+    status = firClCreateBatchFilter(&env, &batch_filter);
+    error(status, "Failed to create batch kernel");
+    cl_mem BatchInput_clmem = firClBufferAcquire(&env, CL_MEM_READ_ONLY, BATCH_CHANNELS*batchSamples*sizeof(short), NULL, &status);
+    error(status, "Failed to create memory for batch input");
+    cl_mem BatchOutput_clmem = firClBufferAcquire(&env, CL_MEM_WRITE_ONLY, BATCH_CHANNELS*batchOutputs*sizeof(float), NULL, &status);
+    error(status, "Failed to create memory for batch output");
+    status = firClBufferWrite(&env, BatchInput_clmem, BATCH_CHANNELS*batchSamples*sizeof(short), batch_inputs, NULL);
+    error(status, "Failed to write the batch input");
+    status = firClEnqueueBatch(&env, &batch_filter, BatchInput_clmem, BatchOutput_clmem, Taps_clmem,
+                               TAPS_SIZE, batchOutputs, BATCH_CHANNELS, false, &batch_event);
+    error(status, "Failed to launch batch kernel");
+    status = firClBufferRead(&env, BatchOutput_clmem, BATCH_CHANNELS*batchOutputs*sizeof(float), batch_gpu, NULL);
+    error(status, "Failed read the batch output");
+    firBatchInterleave(batch_inputs, BATCH_CHANNELS, batchSamples, batch_interleaved);
+    struct timeval batch_start, batch_end;
+    gettimeofday(&batch_start, NULL);
+    firPoolBatch(pool, batch_interleaved, BATCH_CHANNELS, batchOutputs, taps, TAPS_SIZE, false, batch_cpu);
+    gettimeofday(&batch_end, NULL);
+    long long timeBatch = (batch_end.tv_sec - batch_start.tv_sec)*1000000LL + (batch_end.tv_usec - batch_start.tv_usec);
+    firBatchDeinterleave(batch_cpu, BATCH_CHANNELS, batchOutputs, batch_planar);
+    float batchError[2] = {0, 0};
+    float* batch_reference = malloc(sizeof(float)*batchOutputs);
+    for(size_t c = 0; c < BATCH_CHANNELS; c++){
+        const short* channel = batch_inputs + c*batchSamples;
+        firSimd(channel, batchOutputs, taps, TAPS_SIZE, batch_reference);
+        float gpuError = firSimdCheck(channel, batchOutputs, taps, TAPS_SIZE, batch_gpu + c*batchOutputs, batch_reference);
+        float cpuError = firSimdCheck(channel, batchOutputs, taps, TAPS_SIZE, batch_planar + c*batchOutputs, batch_reference);
+        if(gpuError > batchError[0])
+            batchError[0] = gpuError;
+        if(cpuError > batchError[1])
+            batchError[1] = cpuError;
+    }
+    free(batch_reference);
+    firPoolDestroy(pool);
+
+    // Chunked run where the upload, filter and readback of consecutive chunks overlap
+    printf("Pipelining chunks...\n");
+    float* result_pipeline = calloc(INPUT_SIZE, sizeof(float));
+    FirPipeline* pipeline = firPipelineCreate(&env, taps, TAPS_SIZE, 128, 0, &status);
+    error(status, "Failed to create pipeline");
+    struct timeval pipeline_start, pipeline_end;
+    gettimeofday(&pipeline_start, NULL);
+    status = firPipelineSubmit(pipeline, inputs, INPUT_SIZE-TAPS_SIZE+1, result_pipeline, NULL, NULL);
+    error(status, "Failed to submit pipeline");
+    status = firPipelineFinish(pipeline);
+    error(status, "Failed to finish pipeline");
+    gettimeofday(&pipeline_end, NULL);
+    long long timePipeline = (pipeline_end.tv_sec - pipeline_start.tv_sec)*1000000LL + (pipeline_end.tv_usec - pipeline_start.tv_usec);
+    float pipelineError = firSimdCheck(inputs, INPUT_SIZE-TAPS_SIZE+1, taps, TAPS_SIZE, result_pipeline, result_cpu);
+    firPipelineDestroy(pipeline);
     printf("Done! \n");
 
     // Check times
@@ -127,7 +533,76 @@ int main()
     printf("\nTime to copy memory in milliseconds = %f ms\n", (copy_time / 1000000.0) );
     printf("Time read output from buffer in milliseconds = %f ms\n", (read_time / 1000000.0));
     printf("Time execution in milliseconds GPU = %f ms\n", (kernel_time / 1000000.0));
+    cl_ulong tiled_start, tiled_end;
+    clGetEventProfilingInfo(tiled_event, CL_PROFILING_COMMAND_START, sizeof(tiled_start), &tiled_start, NULL);
+    clGetEventProfilingInfo(tiled_event, CL_PROFILING_COMMAND_END, sizeof(tiled_end), &tiled_end, NULL);
+    printf("Time execution in milliseconds GPU tuned = %f ms (%s)\n", ((tiled_end - tiled_start) / 1000000.0),
+           tiledError <= 1.0f ? "match" : "MISMATCH");
+    cl_ulong q15_start, q15_end;
+    clGetEventProfilingInfo(q15_event, CL_PROFILING_COMMAND_START, sizeof(q15_start), &q15_start, NULL);
+    clGetEventProfilingInfo(q15_event, CL_PROFILING_COMMAND_END, sizeof(q15_end), &q15_end, NULL);
+    printf("Time execution in milliseconds GPU Q15 = %f ms (GPU vs CPU %s, %0.1f LSB from float)\n",
+           ((q15_end - q15_start) / 1000000.0),
+           memcmp(outputs_q15, result_q15, outputCount * sizeof(short)) == 0 ? "bit-exact" : "MISMATCH", q15Error);
+    printf("Global memory bytes per output: %0.2f naive, %0.2f tuned\n",
+           firClBytesPerOutput(&naive_filter, TAPS_SIZE), firClBytesPerOutput(&tiled_filter, TAPS_SIZE));
     printf("Time execution in milliseconds CPU = %lld ms\n", timeCPU);
+    printf("Time execution in microseconds CPU %s = %lld us (%0.2f MSamples/s)\n", firSimdIsaName(firSimdIsa()),
+           timeSIMD, timeSIMD > 0 ? (INPUT_SIZE-TAPS_SIZE+1) / (double)timeSIMD : 0.0);
+    printf("CPU %s vs scalar: %s (worst error %0.3f of tolerance)\n", firSimdIsaName(firSimdIsa()),
+           simdError <= 1.0f ? "match" : "MISMATCH", simdError);
+    printf("Time execution in microseconds CPU %u threads = %lld us (%0.2f MSamples/s, %s)\n", firPoolCores(),
+           timeThreads, timeThreads > 0 ? (INPUT_SIZE-TAPS_SIZE+1) / (double)timeThreads : 0.0,
+           threadsError <= 1.0f ? "match" : "MISMATCH");
+    size_t clCrossover = 0;
+    status = firFftClCrossover(&env, &clCrossover);
+    error(status, "Failed to measure the GPU FFT crossover");
+    printf("FFT convolution wins from %zu taps on the CPU, %zu taps on the GPU\n", firFftCrossover(), clCrossover);
+    printf("Streaming CPU: %s, streaming GPU: %s\n", streamError[0] <= 1.0f ? "seamless" : "MISMATCH",
+           streamError[1] <= 1.0f ? "seamless" : "MISMATCH");
+    for(int set = 0; set < 2; set++){
+        printf("%s taps: %s plan, %zu of %d multiplies per output (CPU %s, GPU %s)\n", set ? "Triangle" : "Demo",
+               firTapStructureName(planStructure[set]), planMultiplies[set], TAPS_SIZE,
+               planError[set][0] <= 1.0f ? "match" : "MISMATCH", planError[set][1] <= 1.0f ? "match" : "MISMATCH");
+    }
+    cl_ulong chain_start = 0, chain_end = 0;
+    if(chain_event != NULL){
+        clGetEventProfilingInfo(chain_event, CL_PROFILING_COMMAND_START, sizeof(chain_start), &chain_start, NULL);
+        clGetEventProfilingInfo(chain_event, CL_PROFILING_COMMAND_END, sizeof(chain_end), &chain_end, NULL);
+        clReleaseEvent(chain_event);
+    }
+    printf("Time execution in milliseconds GPU fused 3-stage chain = %f ms (CPU %s, GPU %s; %0.2f bytes per output fused, %0.2f staged)\n",
+           ((chain_end - chain_start) / 1000000.0), chainError[0] <= 1e-3f ? "match" : "MISMATCH",
+           chainError[1] <= 1e-3f ? "match" : "MISMATCH", chainBytes, stagedBytes);
+    printf("Decimate by %d CPU: %s, GPU: %s; interpolate by %d CPU: %s, GPU: %s\n",
+           RATE_DECIMATE, rateError[FIR_DECIMATE][0] <= 1e-3f ? "match" : "MISMATCH",
+           rateError[FIR_DECIMATE][1] <= 1e-3f ? "match" : "MISMATCH",
+           RATE_INTERPOLATE, rateError[FIR_INTERPOLATE][0] <= 1e-3f ? "match" : "MISMATCH",
+           rateError[FIR_INTERPOLATE][1] <= 1e-3f ? "match" : "MISMATCH");
+    printf("Scheduler over %zu executor(s): %s\n", scheduler ? firSchedDevices(scheduler) : 0,
+           schedError <= 1.0f ? "match" : "MISMATCH");
+    for(size_t i = 0; scheduler != NULL && i < firSchedDevices(scheduler); i++){
+        printf("  %s: %zu outputs, %0.2f MSamples/s\n", firSchedDeviceName(scheduler, i),
+               firSchedShare(scheduler, i), firSchedRate(scheduler, i) / 1e6);
+    }
+    firSchedDestroy(scheduler);
+    cl_ulong batch_start_ns, batch_end_ns;
+    clGetEventProfilingInfo(batch_event, CL_PROFILING_COMMAND_START, sizeof(batch_start_ns), &batch_start_ns, NULL);
+    clGetEventProfilingInfo(batch_event, CL_PROFILING_COMMAND_END, sizeof(batch_end_ns), &batch_end_ns, NULL);
+    printf("Time execution in milliseconds GPU batch of %d channels = %f ms (%s)\n", BATCH_CHANNELS,
+           ((batch_end_ns - batch_start_ns) / 1000000.0), batchError[0] <= 1.0f ? "match" : "MISMATCH");
+    printf("Time execution in microseconds CPU batch of %d channels = %lld us (%0.2f MSamples/s, %s)\n", BATCH_CHANNELS,
+           timeBatch, timeBatch > 0 ? (double)BATCH_CHANNELS * batchOutputs / timeBatch : 0.0,
+           batchError[1] <= 1.0f ? "match" : "MISMATCH");
+    printf("Filter handles on %s and two CPU handles sharing one pool, from %d threads: %s\n", handleDevice, HANDLE_THREADS,
+           handleError <= 1.0f ? "match" : "MISMATCH");
+    printf("Time execution in microseconds GPU pipelined (%d chunks in flight) = %lld us (%0.2f MSamples/s, %s)\n",
+           FIR_PIPELINE_DEPTH, timePipeline, timePipeline > 0 ? (INPUT_SIZE-TAPS_SIZE+1) / (double)timePipeline : 0.0,
+           pipelineError <= 1.0f ? "match" : "MISMATCH");
+    if(tracePath != NULL){
+        clFinish(queue);
+        reportTrace(tracePath);
+    }
 
 
 
@@ -138,14 +613,41 @@ int main()
     }
 
     // Free the resources allocated
+    firClBufferRelease(Input_clmem);
+    firClBufferRelease(Output_clmem);
+    firClBufferRelease(Taps_clmem);
+    firClBufferRelease(TapsQ15_clmem);
+    firClBufferRelease(OutputQ15_clmem);
+    firClBufferRelease(BatchInput_clmem);
+    firClBufferRelease(BatchOutput_clmem);
+    firClReleaseBuffers();
+    firClReleaseTunings();
+    firFftReleaseCrossovers();
+    firClReleaseVariants();
     cleanup();
     free(taps);
-    free(inputs);
-    free(outputs);
+    firClHostFree(inputs);
+    firClHostFree(outputs);
     free(result_cpu);
-    clReleaseMemObject(Input_clmem);
-    clReleaseMemObject(Output_clmem);
-    clReleaseMemObject(Taps_clmem);
+    free(result_simd);
+    free(result_threads);
+    free(result_pipeline);
+    free(result_sched);
+    free(outputs_tiled);
+    free(taps_q15);
+    free(outputs_q15);
+    free(result_q15);
+    clReleaseEvent(q15_event);
+    firClReleaseFilter(&q15_filter);
+    free(batch_inputs);
+    free(batch_interleaved);
+    free(batch_gpu);
+    free(batch_cpu);
+    free(batch_planar);
+    clReleaseEvent(batch_event);
+    firClReleaseFilter(&batch_filter);
+    clReleaseEvent(tiled_event);
+    firClReleaseFilter(&tiled_filter);
     return 0;
 }
 